@@ -20,13 +20,25 @@
 
 #include "inactivity_timer.h"
 
+#include <QDebug>
+#include <QFile>
 #include <QVariant>
 
 using namespace OnlineAccountsDaemon;
 
+namespace {
+
+/* Below this percentage of available memory, we don't linger */
+const int lowMemoryPercent = 10;
+
+} // namespace
+
 InactivityTimer::InactivityTimer(int interval, QObject *parent):
     QObject(parent),
-    m_interval(interval)
+    m_interval(interval),
+    m_minimumInterval(interval),
+    m_maximumInterval(interval),
+    m_memInfoFile(QStringLiteral("/proc/meminfo"))
 {
     m_timer.setSingleShot(true);
     QObject::connect(&m_timer, SIGNAL(timeout()),
@@ -42,10 +54,36 @@ void InactivityTimer::watchObject(QObject *object)
     onIdleChanged();
 }
 
+void InactivityTimer::setMaximumInterval(int interval)
+{
+    m_maximumInterval = qMax(interval, m_minimumInterval);
+}
+
+void InactivityTimer::adaptInterval(int previousInterval,
+                                    qint64 msecsSinceExit)
+{
+    int interval = qBound(m_minimumInterval, previousInterval,
+                          m_maximumInterval);
+    if (msecsSinceExit >= 0 && msecsSinceExit < interval) {
+        /* We got respawned less than one interval after exiting: had we
+         * waited for twice the interval, we would still have been running
+         * and the startup would have been saved. */
+        interval = qMin(interval * 2, m_maximumInterval);
+    } else if (msecsSinceExit > interval * 4) {
+        interval = qMax(interval / 2, m_minimumInterval);
+    }
+
+    if (interval != m_interval) {
+        qDebug() << "Inactivity timeout set to" << interval << "ms";
+        m_interval = interval;
+    }
+}
+
 void InactivityTimer::onIdleChanged()
 {
     if (allObjectsAreIdle()) {
-        m_timer.start(m_interval);
+        m_timer.start(isUnderMemoryPressure() ?
+                      m_minimumInterval : m_interval);
     } else {
         m_timer.stop();
     }
@@ -67,3 +105,26 @@ bool InactivityTimer::allObjectsAreIdle() const
     }
     return true;
 }
+
+bool InactivityTimer::isUnderMemoryPressure() const
+{
+    QFile file(m_memInfoFile);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    qint64 total = 0, available = 0;
+    while (total == 0 || available == 0) {
+        QByteArray line = file.readLine();
+        if (line.isEmpty()) break;
+
+        QList<QByteArray> fields = line.simplified().split(' ');
+        if (fields.count() < 2) continue;
+        if (fields[0] == "MemTotal:") {
+            total = fields[1].toLongLong();
+        } else if (fields[0] == "MemAvailable:") {
+            available = fields[1].toLongLong();
+        }
+    }
+
+    return total > 0 && available > 0 &&
+        available * 100 < total * lowMemoryPercent;
+}
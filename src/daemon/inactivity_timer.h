@@ -37,6 +37,14 @@ public:
 
     void watchObject(QObject *object);
 
+    void setMaximumInterval(int interval);
+    int interval() const { return m_interval; }
+
+    void adaptInterval(int previousInterval, qint64 msecsSinceExit);
+
+    /* Only meant to be used by tests */
+    void setMemInfoFile(const QString &path) { m_memInfoFile = path; }
+
 Q_SIGNALS:
     void timeout();
 
@@ -46,11 +54,15 @@ private Q_SLOTS:
 
 private:
     bool allObjectsAreIdle() const;
+    bool isUnderMemoryPressure() const;
 
 private:
     QList<QObject*> m_watchedObjects;
     QTimer m_timer;
     int m_interval;
+    int m_minimumInterval;
+    int m_maximumInterval;
+    QString m_memInfoFile;
 };
 
 } // namespace
@@ -20,18 +20,74 @@
 
 #include <QCoreApplication>
 #include <QDBusConnection>
+#include <QDebug>
 #include <QProcessEnvironment>
+#include <QSocketNotifier>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include "inactivity_timer.h"
 #include "OnlineAccountsDaemon/Manager"
+#include "OnlineAccountsDaemon/startup_timings.h"
+
+using OnlineAccountsDaemon::StartupTimings;
+
+static void markStartupPhase(QObject *manager, const char *phase,
+                             qint64 timestamp = StartupTimings::now())
+{
+    QMetaObject::invokeMethod(manager, "markStartupPhase",
+                              Q_ARG(QString, QString::fromLatin1(phase)),
+                              Q_ARG(qint64, timestamp));
+}
+
+static int sigusr1Fds[2];
+
+static void sigusr1Handler(int)
+{
+    char c = 1;
+    ssize_t ret = ::write(sigusr1Fds[0], &c, sizeof(c));
+    Q_UNUSED(ret);
+}
+
+/* SIGUSR1 dumps the recent call traces; the signal handler just wakes up
+ * the main loop, which does the actual work. */
+static QSocketNotifier *watchSigusr1(QObject *manager)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sigusr1Fds) != 0) {
+        qWarning() << "Couldn't create socket pair for SIGUSR1";
+        return 0;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = sigusr1Handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &action, 0) != 0) {
+        qWarning() << "Couldn't install SIGUSR1 handler";
+        return 0;
+    }
+
+    auto notifier = new QSocketNotifier(sigusr1Fds[1], QSocketNotifier::Read);
+    QObject::connect(notifier, &QSocketNotifier::activated, [manager]() {
+        char c;
+        ssize_t ret = ::read(sigusr1Fds[1], &c, sizeof(c));
+        Q_UNUSED(ret);
+        QMetaObject::invokeMethod(manager, "writeTrace");
+    });
+    return notifier;
+}
 
 int main(int argc, char **argv)
 {
+    qint64 mainTime = StartupTimings::now();
     QCoreApplication app(argc, argv);
 
     QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
 
     /* default daemonTimeout to 5 seconds */
     int daemonTimeout = 5;
+    /* if respawned too often, wait up to 2 minutes */
+    int maxDaemonTimeout = 120;
 
     /* override daemonTimeout if OAU_DAEMON_TIMEOUT is set */
     if (environment.contains(QLatin1String("OAD_TIMEOUT"))) {
@@ -39,30 +95,55 @@ int main(int argc, char **argv)
         int value = environment.value(
             QLatin1String("OAD_TIMEOUT")).toInt(&isOk);
         if (isOk)
-            daemonTimeout = value;
+            daemonTimeout = maxDaemonTimeout = value;
     }
 
+    /* an explicit timeout is not adapted, unless OAD_MAX_TIMEOUT is set */
+    if (environment.contains(QLatin1String("OAD_MAX_TIMEOUT"))) {
+        bool isOk;
+        int value = environment.value(
+            QLatin1String("OAD_MAX_TIMEOUT")).toInt(&isOk);
+        if (isOk)
+            maxDaemonTimeout = value;
+    }
+
+    /* The manager defers loading the accounts to the main loop: claim the
+     * service name right away, since activating clients are waiting for it */
     auto manager = (QObject *)oad_create_manager(0);
+    markStartupPhase(manager, "main", mainTime);
+    markStartupPhase(manager, "managerCreated");
+
+    QDBusConnection bus = QDBusConnection::sessionBus();
+    bus.registerObject("/com/ubuntu/OnlineAccounts/Manager", manager);
+    bus.registerService("com.ubuntu.OnlineAccounts.Manager");
+    markStartupPhase(manager, "busRegistered");
 
     auto inactivityTimer =
         new OnlineAccountsDaemon::InactivityTimer(daemonTimeout * 1000);
+    inactivityTimer->setMaximumInterval(maxDaemonTimeout * 1000);
+    inactivityTimer->adaptInterval(
+        manager->property("inactivityTimeout").toInt(),
+        manager->property("msecsSinceIdleExit").toLongLong());
+    manager->setProperty("inactivityTimeout", inactivityTimer->interval());
     inactivityTimer->watchObject(manager);
+    QObject::connect(inactivityTimer, SIGNAL(timeout()),
+                     manager, SLOT(onInactivityTimeout()));
     QObject::connect(inactivityTimer, SIGNAL(timeout()), &app, SLOT(quit()));
 
-    QDBusConnection bus = QDBusConnection::sessionBus();
-    bus.registerObject("/com/ubuntu/OnlineAccounts/Manager", manager);
-    bus.registerService("com.ubuntu.OnlineAccounts.Manager");
     bus.connect(QString(),
                 QStringLiteral("/org/freedesktop/DBus/Local"),
                 QStringLiteral("org.freedesktop.DBus.Local"),
                 QStringLiteral("Disconnected"),
                 manager, SLOT(onDisconnected()));
 
+    QSocketNotifier *sigusr1Notifier = watchSigusr1(manager);
+
     int ret = app.exec();
 
     bus.unregisterService("com.ubuntu.OnlineAccounts.Manager");
     bus.unregisterObject("/com/ubuntu/OnlineAccounts/Manager");
 
+    delete sigusr1Notifier;
     delete inactivityTimer;
     delete manager;
 
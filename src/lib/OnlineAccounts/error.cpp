@@ -35,6 +35,8 @@ Error errorFromDBus(const QDBusError &dbusError)
         code = Error::UserCanceled;
     } else if (name == ONLINE_ACCOUNTS_ERROR_INTERACTION_REQUIRED) {
         code = Error::InteractionRequired;
+    } else if (name == ONLINE_ACCOUNTS_ERROR_THROTTLED) {
+        code = Error::Throttled;
     }
     return Error(code, dbusError.message());
 }
@@ -38,6 +38,7 @@ public:
         UserCanceled, /* The user dismissed the authentication prompt */
         PermissionDenied,
         InteractionRequired,
+        Throttled, /* Too many calls from this client; retry later */
     };
 
     Error(): m_code(NoError) {}
@@ -27,12 +27,17 @@
 #include "account_p.h"
 #include "authentication_data_p.h"
 #include "OnlineAccountsDaemon/dbus_constants.h"
+#include "error_p.h"
 #include "pending_call_p.h"
 
 using namespace OnlineAccounts;
 
 Q_LOGGING_CATEGORY(DBG_ONLINE_ACCOUNTS, "OnlineAccounts", QtWarningMsg)
 
+/* Delays before retrying a throttled GetAccounts call, in milliseconds */
+static const int firstRetryDelay = 1000;
+static const int maxRetryDelay = 60000;
+
 ManagerPrivate::ManagerPrivate(Manager *q, const QString &applicationId,
                                const QDBusConnection& bus):
     QObject(),
@@ -42,11 +47,16 @@ ManagerPrivate::ManagerPrivate(Manager *q, const QString &applicationId,
              ONLINE_ACCOUNTS_MANAGER_INTERFACE,
              bus),
     m_getAccountsCall(0),
+    m_throttledCalls(0),
     q_ptr(q)
 {
     qRegisterMetaType<Account*>();
     qRegisterMetaType<Service>("OnlineAccounts::Service");
 
+    m_retryTimer.setSingleShot(true);
+    QObject::connect(&m_retryTimer, SIGNAL(timeout()),
+                     this, SLOT(retrieveAccounts()));
+
     QObject::connect(&m_daemon,
                      SIGNAL(accountChanged(const QString&, const OnlineAccounts::AccountInfo&)),
                      this,
@@ -127,6 +137,23 @@ void ManagerPrivate::onGetAccountsFinished()
     Q_ASSERT(m_getAccountsCall);
 
     QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap>> reply = *m_getAccountsCall;
+    m_getAccountsCall->deleteLater();
+    m_getAccountsCall = 0;
+
+    if (Q_UNLIKELY(reply.isError()) &&
+        errorFromDBus(reply.error()).code() == Error::Throttled) {
+        /* The daemon has not refused us the accounts, it's just busy: we
+         * are not ready until we get them */
+        int delay = qMin(firstRetryDelay << qMin(m_throttledCalls, 6),
+                         maxRetryDelay);
+        m_throttledCalls++;
+        qCWarning(DBG_ONLINE_ACCOUNTS) << "GetAccounts call throttled,"
+            " retrying in" << delay << "ms";
+        m_retryTimer.start(delay);
+        return;
+    }
+    m_throttledCalls = 0;
+
     if (Q_UNLIKELY(reply.isError())) {
         qCWarning(DBG_ONLINE_ACCOUNTS) << "GetAccounts call failed:" <<
             reply.error();
@@ -144,8 +171,6 @@ void ManagerPrivate::onGetAccountsFinished()
             m_services.insert(service.id(), service);
         }
     }
-    m_getAccountsCall->deleteLater();
-    m_getAccountsCall = 0;
 
     Q_EMIT q->ready();
 }
@@ -193,12 +218,15 @@ Manager::~Manager()
 bool Manager::isReady() const
 {
     Q_D(const Manager);
-    return !d->m_getAccountsCall;
+    return !d->m_getAccountsCall && !d->m_retryTimer.isActive();
 }
 
 void Manager::waitForReady()
 {
     Q_D(Manager);
+    /* If the call gets throttled, the manager is still not ready when this
+     * returns: the call is retried from the event loop, and ready() is
+     * emitted later. */
     if (d->m_getAccountsCall) {
         d->m_getAccountsCall->waitForFinished();
     }
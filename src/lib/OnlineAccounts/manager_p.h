@@ -27,6 +27,7 @@
 #include <QObject>
 #include <QPair>
 #include <QPointer>
+#include <QTimer>
 #include "account_info.h"
 #include "dbus_interface.h"
 
@@ -63,10 +64,8 @@ public:
         return m_services.value(serviceId);
     }
 
-private:
-    void retrieveAccounts();
-
 private Q_SLOTS:
+    void retrieveAccounts();
     void onGetAccountsFinished();
     void onAccountChanged(const QString &service,
                           const OnlineAccounts::AccountInfo &info);
@@ -75,6 +74,9 @@ private:
     QString m_applicationId;
     DBusInterface m_daemon;
     QDBusPendingCallWatcher *m_getAccountsCall;
+    /* Running while waiting to retry a throttled GetAccounts call */
+    QTimer m_retryTimer;
+    int m_throttledCalls;
     QMap<QPair<AccountId,QString>,AccountData> m_accounts;
     QMap<QString,Service> m_services;
     mutable Manager *q_ptr;
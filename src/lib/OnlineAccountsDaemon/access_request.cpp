@@ -114,6 +114,8 @@ AccessRequest::AccessRequest(const CallContext &context, QObject *parent):
     AsyncOperation(context, parent),
     d_ptr(new AccessRequestPrivate(this))
 {
+    d_ptr->m_authenticator.setTraceId(context.traceId());
+    d_ptr->m_authenticator.setClientId(context.clientId());
 }
 
 AccessRequest::~AccessRequest()
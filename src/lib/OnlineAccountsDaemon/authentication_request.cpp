@@ -69,6 +69,8 @@ AuthenticationRequest::AuthenticationRequest(const CallContext &context, QObject
     AsyncOperation(context, parent),
     d_ptr(new AuthenticationRequestPrivate(this))
 {
+    d_ptr->m_authenticator.setTraceId(context.traceId());
+    d_ptr->m_authenticator.setClientId(context.clientId());
 }
 
 AuthenticationRequest::~AuthenticationRequest()
@@ -22,10 +22,14 @@
 
 #include <Accounts/AuthData>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <SignOn/AuthSession>
 #include <SignOn/Identity>
 #include <SignOn/SessionData>
+#include "call_statistics.h"
+#include "client_accounting.h"
 #include "dbus_constants.h"
+#include "tracer.h"
 
 using namespace OnlineAccountsDaemon;
 
@@ -58,6 +62,7 @@ class AuthenticatorPrivate: public QObject
 
 public:
     AuthenticatorPrivate(Authenticator *q);
+    ~AuthenticatorPrivate();
 
     void authenticate(const Accounts::AuthData &authData,
                       const QVariantMap &parameters);
@@ -77,6 +82,9 @@ private:
     QString m_errorName;
     QString m_errorMessage;
     bool m_invalidateCache;
+    QElapsedTimer m_signondTimer;
+    quint32 m_traceId;
+    uint m_clientId;
     Authenticator *q_ptr;
 };
 
@@ -88,10 +96,19 @@ AuthenticatorPrivate::AuthenticatorPrivate(Authenticator *q):
     m_identity(0),
     m_authMethod(ONLINE_ACCOUNTS_AUTH_METHOD_UNKNOWN),
     m_invalidateCache(false),
+    m_traceId(0),
+    m_clientId(0),
     q_ptr(q)
 {
 }
 
+AuthenticatorPrivate::~AuthenticatorPrivate()
+{
+    if (m_authSession) {
+        ClientAccounting::instance()->signondSessionClosed(m_clientId);
+    }
+}
+
 void AuthenticatorPrivate::authenticate(const Accounts::AuthData &authData,
                                         const QVariantMap &parameters)
 {
@@ -107,6 +124,8 @@ void AuthenticatorPrivate::authenticate(const Accounts::AuthData &authData,
                          SLOT(onAuthSessionResponse(const SignOn::SessionData&)));
         QObject::connect(m_authSession, SIGNAL(error(const SignOn::Error&)),
                          this, SLOT(onAuthSessionError(const SignOn::Error&)));
+        Tracer::instance()->addEvent(m_traceId, "signondSessionCreated");
+        ClientAccounting::instance()->signondSessionOpened(m_clientId);
     }
 
     QVariantMap allSessionData =
@@ -138,12 +157,17 @@ void AuthenticatorPrivate::authenticate(const Accounts::AuthData &authData,
             allSessionData.value("ConsumerSecret");
     }
 
+    m_signondTimer.start();
     m_authSession->process(allSessionData, mechanism);
+    Tracer::instance()->addEvent(m_traceId, "processSent");
 }
 
 void AuthenticatorPrivate::onAuthSessionResponse(const SignOn::SessionData &sessionData)
 {
     Q_Q(Authenticator);
+    Tracer::instance()->addEvent(m_traceId, "replyReceived");
+    CallStatistics::instance()->
+        addSignondRoundTrip(m_signondTimer.nsecsElapsed());
     QVariantMap signonReply;
 
     /* Perform some method-specific translation of reply keys */
@@ -192,6 +216,9 @@ QString AuthenticatorPrivate::signonErrorName(int type)
 void AuthenticatorPrivate::onAuthSessionError(const SignOn::Error &error)
 {
     Q_Q(Authenticator);
+    Tracer::instance()->addEvent(m_traceId, "replyReceived");
+    CallStatistics::instance()->
+        addSignondRoundTrip(m_signondTimer.nsecsElapsed());
     m_errorName = signonErrorName(error.type());
     m_errorMessage = error.message();
     Q_EMIT q->finished();
@@ -208,6 +235,18 @@ Authenticator::~Authenticator()
     delete d_ptr;
 }
 
+void Authenticator::setTraceId(quint32 traceId)
+{
+    Q_D(Authenticator);
+    d->m_traceId = traceId;
+}
+
+void Authenticator::setClientId(uint clientId)
+{
+    Q_D(Authenticator);
+    d->m_clientId = clientId;
+}
+
 void Authenticator::setInteractive(bool interactive)
 {
     Q_D(Authenticator);
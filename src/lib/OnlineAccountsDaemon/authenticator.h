@@ -40,6 +40,9 @@ public:
     explicit Authenticator(QObject *parent = 0);
     ~Authenticator();
 
+    void setTraceId(quint32 traceId);
+    /* The client to charge with the signond session */
+    void setClientId(uint clientId);
     void setInteractive(bool interactive);
     void invalidateCache();
 
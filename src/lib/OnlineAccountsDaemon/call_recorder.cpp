@@ -0,0 +1,145 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "call_recorder.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "dbus_constants.h"
+#include "manager_adaptor.h"
+
+using namespace OnlineAccountsDaemon;
+
+static CallRecorder *m_callRecorderInstance = 0;
+
+CallRecorder::CallRecorder()
+{
+    QString fileName = QString::fromUtf8(qgetenv("OAD_RECORD_CALLS"));
+    if (fileName.isEmpty()) return;
+
+    m_file.setFileName(fileName);
+    if (Q_UNLIKELY(!m_file.open(QIODevice::WriteOnly | QIODevice::Append))) {
+        qWarning() << "Cannot record calls into" << fileName <<
+            m_file.errorString();
+        return;
+    }
+
+    QJsonObject session {
+        { "sessionStartMs", QDateTime::currentMSecsSinceEpoch() },
+    };
+    m_file.write(QJsonDocument(session).toJson(QJsonDocument::Compact));
+    m_file.write("\n");
+    m_file.flush();
+}
+
+CallRecorder *CallRecorder::instance()
+{
+    if (!m_callRecorderInstance) {
+        m_callRecorderInstance = new CallRecorder;
+    }
+    return m_callRecorderInstance;
+}
+
+int CallRecorder::anonymize(const QString &kind, const QString &value)
+{
+    QHash<QString,int> &ids = m_ids[kind];
+    auto i = ids.constFind(value);
+    if (i != ids.constEnd()) return i.value();
+    int id = ids.count();
+    ids.insert(value, id);
+    return id;
+}
+
+void CallRecorder::recordGetAccounts(const CallContext &context,
+                                     const QVariantMap &filters)
+{
+    if (!isEnabled()) return;
+
+    QVariantMap args;
+    QString applicationId = filters.value("applicationId").toString();
+    if (!applicationId.isEmpty()) {
+        args["application"] = anonymize("application", applicationId);
+    }
+    QString serviceId =
+        filters.value(ONLINE_ACCOUNTS_INFO_KEY_SERVICE_ID).toString();
+    if (!serviceId.isEmpty()) {
+        args["service"] = anonymize("service", serviceId);
+    }
+    if (filters.contains("accountId")) {
+        args["account"] = anonymize("account",
+                                    filters.value("accountId").toString());
+    }
+    record(context, "GetAccounts", args);
+}
+
+void CallRecorder::recordAuthenticate(const CallContext &context,
+                                      uint accountId,
+                                      const QString &serviceId,
+                                      bool interactive, bool invalidate,
+                                      const QVariantMap &parameters)
+{
+    if (!isEnabled()) return;
+
+    QVariantMap args {
+        { "account", anonymize("account", QString::number(accountId)) },
+        { "service", anonymize("service", serviceId) },
+        { "interactive", interactive },
+        { "invalidate", invalidate },
+        { "parameterCount", parameters.count() },
+    };
+    record(context, "Authenticate", args);
+}
+
+void CallRecorder::recordRequestAccess(const CallContext &context,
+                                       const QString &serviceId,
+                                       const QVariantMap &parameters)
+{
+    if (!isEnabled()) return;
+
+    QVariantMap args {
+        { "service", anonymize("service", serviceId) },
+        { "parameterCount", parameters.count() },
+    };
+    record(context, "RequestAccess", args);
+}
+
+void CallRecorder::record(const CallContext &context, const QString &method,
+                          const QVariantMap &args)
+{
+    QString securityContext = context.securityContext();
+    QJsonObject call {
+        { "timeMs", QDateTime::currentMSecsSinceEpoch() },
+        { "client", anonymize("client", context.clientName()) },
+        { "method", method },
+        { "args", QJsonObject::fromVariantMap(args) },
+    };
+    /* Whether the client is confined matters to the daemon */
+    if (securityContext == "unconfined") {
+        call.insert("profile", securityContext);
+    } else {
+        call.insert("profile", anonymize("profile", securityContext));
+    }
+
+    m_file.write(QJsonDocument(call).toJson(QJsonDocument::Compact));
+    m_file.write("\n");
+    m_file.flush();
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_CALL_RECORDER_H
+#define ONLINE_ACCOUNTS_DAEMON_CALL_RECORDER_H
+
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVariantMap>
+
+namespace OnlineAccountsDaemon {
+
+class CallContext;
+
+/* Writes the incoming Manager calls into the file named by the
+ * OAD_RECORD_CALLS environment variable, one JSON object per line, for the
+ * replay tool in the tests. Clients, security contexts, accounts, services
+ * and applications are replaced by the order in which they were first seen;
+ * the values of the parameters are not recorded at all.
+ *
+ * Every daemon process appends a session marker before its calls: the
+ * anonymised IDs are only meaningful within a session. Times are in
+ * milliseconds since the epoch, so that they can be compared across
+ * sessions. */
+class CallRecorder
+{
+public:
+    static CallRecorder *instance();
+
+    bool isEnabled() const { return m_file.isOpen(); }
+
+    void recordGetAccounts(const CallContext &context,
+                           const QVariantMap &filters);
+    void recordAuthenticate(const CallContext &context,
+                            uint accountId, const QString &serviceId,
+                            bool interactive, bool invalidate,
+                            const QVariantMap &parameters);
+    void recordRequestAccess(const CallContext &context,
+                             const QString &serviceId,
+                             const QVariantMap &parameters);
+
+private:
+    CallRecorder();
+
+    int anonymize(const QString &kind, const QString &value);
+    void record(const CallContext &context, const QString &method,
+                const QVariantMap &args);
+
+private:
+    QFile m_file;
+    QHash<QString,QHash<QString,int> > m_ids;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_CALL_RECORDER_H
@@ -0,0 +1,169 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "call_statistics.h"
+
+#include <QVariantList>
+
+using namespace OnlineAccountsDaemon;
+
+namespace {
+
+/* Up to 2^24 us, about 16 seconds, plus one bucket for the longer ones */
+const int histogramBuckets = 26;
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram():
+    m_buckets(histogramBuckets, 0),
+    m_count(0),
+    m_totalUsecs(0),
+    m_maxUsecs(0)
+{
+}
+
+void LatencyHistogram::addSample(qint64 nsecs)
+{
+    qint64 usecs = nsecs / 1000;
+    int bucket = 0;
+    while (bucket < histogramBuckets - 1 && (Q_INT64_C(1) << bucket) <= usecs) {
+        bucket++;
+    }
+    m_buckets[bucket]++;
+    m_count++;
+    m_totalUsecs += usecs;
+    m_maxUsecs = qMax(m_maxUsecs, usecs);
+}
+
+QVariantMap LatencyHistogram::toMap() const
+{
+    /* Trailing empty buckets are omitted */
+    int last = m_buckets.count() - 1;
+    while (last >= 0 && m_buckets[last] == 0) last--;
+
+    QVariantList buckets;
+    for (int i = 0; i <= last; i++) {
+        buckets.append(m_buckets[i]);
+    }
+
+    return QVariantMap {
+        { "count", m_count },
+        { "totalUs", m_totalUsecs },
+        { "maxUs", m_maxUsecs },
+        { "log2Buckets", buckets },
+    };
+}
+
+static CallStatistics *m_callStatisticsInstance = 0;
+
+CallStatistics::CallStatistics():
+    m_isEnabled(false)
+{
+}
+
+CallStatistics *CallStatistics::instance()
+{
+    if (!m_callStatisticsInstance) {
+        m_callStatisticsInstance = new CallStatistics;
+    }
+    return m_callStatisticsInstance;
+}
+
+void CallStatistics::addCall(const QString &method, uint clientId,
+                             const QString &clientName, qint64 nsecs,
+                             const QString &errorName)
+{
+    if (!m_isEnabled) return;
+
+    MethodStats &stats = m_methods[method];
+    stats.calls++;
+    stats.latency.addSample(nsecs);
+    ClientStats &clientStats = m_clients[clientId];
+    clientStats.name = clientName;
+    clientStats.calls++;
+    if (!errorName.isEmpty()) {
+        stats.errors++;
+        m_errors[errorName]++;
+    }
+}
+
+void CallStatistics::removeClient(uint clientId)
+{
+    m_clients.remove(clientId);
+}
+
+void CallStatistics::addCacheLookup(const QString &cache, bool hit)
+{
+    if (!m_isEnabled) return;
+
+    CacheStats &stats = m_caches[cache];
+    if (hit) {
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+}
+
+void CallStatistics::addSignondRoundTrip(qint64 nsecs)
+{
+    if (!m_isEnabled) return;
+
+    m_signondRoundTrips.addSample(nsecs);
+}
+
+QVariantMap CallStatistics::toMap() const
+{
+    QVariantMap methods;
+    for (auto i = m_methods.constBegin(); i != m_methods.constEnd(); i++) {
+        QVariantMap method = i.value().latency.toMap();
+        method.insert("calls", i.value().calls);
+        method.insert("errors", i.value().errors);
+        methods.insert(i.key(), method);
+    }
+
+    QVariantMap clients;
+    for (auto i = m_clients.constBegin(); i != m_clients.constEnd(); i++) {
+        clients.insert(i.value().name, i.value().calls);
+    }
+
+    QVariantMap errors;
+    for (auto i = m_errors.constBegin(); i != m_errors.constEnd(); i++) {
+        errors.insert(i.key(), i.value());
+    }
+
+    QVariantMap caches;
+    for (auto i = m_caches.constBegin(); i != m_caches.constEnd(); i++) {
+        const CacheStats &stats = i.value();
+        quint32 lookups = stats.hits + stats.misses;
+        caches.insert(i.key(), QVariantMap {
+            { "hits", stats.hits },
+            { "misses", stats.misses },
+            { "hitRate", lookups > 0 ? double(stats.hits) / lookups : 0.0 },
+        });
+    }
+
+    return QVariantMap {
+        { "methods", methods },
+        { "clients", clients },
+        { "errors", errors },
+        { "caches", caches },
+        { "signondRoundTrips", m_signondRoundTrips.toMap() },
+    };
+}
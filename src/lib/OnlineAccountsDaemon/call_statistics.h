@@ -0,0 +1,100 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_CALL_STATISTICS_H
+#define ONLINE_ACCOUNTS_DAEMON_CALL_STATISTICS_H
+
+#include <QHash>
+#include <QString>
+#include <QVariantMap>
+#include <QVector>
+
+namespace OnlineAccountsDaemon {
+
+/* Latency histogram with power-of-two buckets: bucket N counts the samples
+ * lasting less than 2^N microseconds (and at least 2^(N-1)); the last bucket
+ * holds everything longer. */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void addSample(qint64 nsecs);
+    QVariantMap toMap() const;
+
+private:
+    QVector<quint32> m_buckets;
+    quint32 m_count;
+    qint64 m_totalUsecs;
+    qint64 m_maxUsecs;
+};
+
+class CallStatistics
+{
+public:
+    static CallStatistics *instance();
+
+    /* Nothing is collected unless enabled */
+    void setEnabled(bool enabled) { m_isEnabled = enabled; }
+    bool isEnabled() const { return m_isEnabled; }
+
+    void addCall(const QString &method, uint clientId,
+                 const QString &clientName, qint64 nsecs,
+                 const QString &errorName = QString());
+    void removeClient(uint clientId);
+    void addCacheLookup(const QString &cache, bool hit);
+    void addSignondRoundTrip(qint64 nsecs);
+
+    QVariantMap toMap() const;
+
+private:
+    CallStatistics();
+
+    struct MethodStats {
+        MethodStats(): calls(0), errors(0) {}
+        quint32 calls;
+        quint32 errors;
+        LatencyHistogram latency;
+    };
+
+    struct ClientStats {
+        ClientStats(): calls(0) {}
+        QString name;
+        quint32 calls;
+    };
+
+    struct CacheStats {
+        CacheStats(): hits(0), misses(0) {}
+        quint32 hits;
+        quint32 misses;
+    };
+
+    bool m_isEnabled;
+    QHash<QString,MethodStats> m_methods;
+    /* Keyed by client ID, and dropped when the client goes away */
+    QHash<uint,ClientStats> m_clients;
+    QHash<QString,quint32> m_errors;
+    QHash<QString,CacheStats> m_caches;
+    LatencyHistogram m_signondRoundTrips;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_CALL_STATISTICS_H
@@ -0,0 +1,215 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "client_accounting.h"
+
+#include <QElapsedTimer>
+#include <time.h>
+
+using namespace OnlineAccountsDaemon;
+
+namespace {
+
+const qint64 windowMsecs = 60 * 1000;
+
+uint quotaFromEnvironment(const char *name)
+{
+    return qgetenv(name).toUInt();
+}
+
+qint64 threadCpuNsecs()
+{
+    struct timespec ts;
+    if (Q_UNLIKELY(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)) {
+        return 0;
+    }
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+QElapsedTimer &monotonicClock()
+{
+    static QElapsedTimer clock;
+    if (!clock.isValid()) clock.start();
+    return clock;
+}
+
+} // namespace
+
+static ClientAccounting *m_clientAccountingInstance = 0;
+
+ClientAccounting::ClientAccounting():
+    m_isEnabled(false),
+    m_maxCallsPerMinute(quotaFromEnvironment("OAD_QUOTA_CALLS_PER_MINUTE")),
+    m_maxCpuNsecsPerMinute(
+        qint64(quotaFromEnvironment("OAD_QUOTA_CPU_MS_PER_MINUTE")) * 1000000),
+    m_maxInFlight(quotaFromEnvironment("OAD_QUOTA_IN_FLIGHT")),
+    m_maxSignondSessions(quotaFromEnvironment("OAD_QUOTA_SIGNOND_SESSIONS"))
+{
+}
+
+ClientAccounting *ClientAccounting::instance()
+{
+    if (!m_clientAccountingInstance) {
+        m_clientAccountingInstance = new ClientAccounting;
+    }
+    return m_clientAccountingInstance;
+}
+
+bool ClientAccounting::hasQuotas() const
+{
+    return m_maxCallsPerMinute > 0 || m_maxCpuNsecsPerMinute > 0 ||
+        m_maxInFlight > 0 || m_maxSignondSessions > 0;
+}
+
+void ClientAccounting::updateWindow(ClientUsage &usage, qint64 now) const
+{
+    if (now - usage.windowStart >= windowMsecs) {
+        usage.windowStart = now;
+        usage.windowCalls = 0;
+        usage.windowCpuNsecs = 0;
+    }
+}
+
+bool ClientAccounting::admitCall(uint clientId, const QString &clientName,
+                                 const QString &securityContext,
+                                 bool isDelayed, QString *reason)
+{
+    /* Clients which could not be registered have no ID */
+    if (!isEnabled() || clientId == 0) return true;
+
+    ClientUsage &usage = m_clients[clientId];
+    if (usage.name.isEmpty()) {
+        usage.name = clientName;
+        usage.securityContext = securityContext;
+    }
+    updateWindow(usage, monotonicClock().elapsed());
+
+    QString why;
+    if (m_maxCallsPerMinute > 0 &&
+        usage.windowCalls >= m_maxCallsPerMinute) {
+        why = QString("More than %1 calls per minute").
+            arg(m_maxCallsPerMinute);
+    } else if (m_maxCpuNsecsPerMinute > 0 &&
+               usage.windowCpuNsecs >= m_maxCpuNsecsPerMinute) {
+        why = QString("More than %1 ms of CPU time per minute").
+            arg(m_maxCpuNsecsPerMinute / 1000000);
+    } else if (isDelayed && m_maxInFlight > 0 &&
+               usage.inFlight >= m_maxInFlight) {
+        why = QString("More than %1 calls in flight").arg(m_maxInFlight);
+    } else if (isDelayed && m_maxSignondSessions > 0 &&
+               usage.signondSessions >= m_maxSignondSessions) {
+        why = QString("More than %1 authentication sessions").
+            arg(m_maxSignondSessions);
+    }
+
+    if (!why.isEmpty()) {
+        usage.throttledCalls++;
+        if (reason) *reason = why;
+        return false;
+    }
+
+    usage.calls++;
+    usage.windowCalls++;
+    if (isDelayed) {
+        usage.inFlight++;
+        usage.inFlightPeak = qMax(usage.inFlightPeak, usage.inFlight);
+    }
+    return true;
+}
+
+void ClientAccounting::callFinished(uint clientId)
+{
+    auto i = m_clients.find(clientId);
+    if (i == m_clients.end() || i->inFlight == 0) return;
+    i->inFlight--;
+}
+
+void ClientAccounting::addHandlerTime(uint clientId, qint64 cpuNsecs)
+{
+    auto i = m_clients.find(clientId);
+    if (i == m_clients.end()) return;
+    updateWindow(*i, monotonicClock().elapsed());
+    i->cpuNsecs += cpuNsecs;
+    i->windowCpuNsecs += cpuNsecs;
+}
+
+void ClientAccounting::signondSessionOpened(uint clientId)
+{
+    auto i = m_clients.find(clientId);
+    if (i == m_clients.end()) return;
+    i->signondSessions++;
+}
+
+void ClientAccounting::signondSessionClosed(uint clientId)
+{
+    auto i = m_clients.find(clientId);
+    if (i == m_clients.end() || i->signondSessions == 0) return;
+    i->signondSessions--;
+}
+
+void ClientAccounting::removeClient(uint clientId)
+{
+    m_clients.remove(clientId);
+}
+
+QVariantMap ClientAccounting::toMap() const
+{
+    QVariantMap clients;
+    for (auto i = m_clients.constBegin(); i != m_clients.constEnd(); i++) {
+        const ClientUsage &usage = i.value();
+        clients.insert(QString::number(i.key()), QVariantMap {
+            { "name", usage.name },
+            { "securityContext", usage.securityContext },
+            { "calls", usage.calls },
+            { "throttledCalls", usage.throttledCalls },
+            { "handlerCpuUs", usage.cpuNsecs / 1000 },
+            { "inFlight", usage.inFlight },
+            { "inFlightPeak", usage.inFlightPeak },
+            { "signondSessions", usage.signondSessions },
+        });
+    }
+
+    return QVariantMap {
+        { "enabled", isEnabled() },
+        { "quotas", QVariantMap {
+            { "callsPerMinute", m_maxCallsPerMinute },
+            { "cpuMsPerMinute", m_maxCpuNsecsPerMinute / 1000000 },
+            { "inFlight", m_maxInFlight },
+            { "signondSessions", m_maxSignondSessions },
+        }},
+        { "clients", clients },
+    };
+}
+
+ClientCpuScope::ClientCpuScope(uint clientId):
+    m_clientId(clientId),
+    m_startNsecs(0)
+{
+    if (ClientAccounting::instance()->isEnabled()) {
+        m_startNsecs = threadCpuNsecs();
+    }
+}
+
+ClientCpuScope::~ClientCpuScope()
+{
+    ClientAccounting *accounting = ClientAccounting::instance();
+    if (!accounting->isEnabled() || m_clientId == 0) return;
+    accounting->addHandlerTime(m_clientId, threadCpuNsecs() - m_startNsecs);
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_CLIENT_ACCOUNTING_H
+#define ONLINE_ACCOUNTS_DAEMON_CLIENT_ACCOUNTING_H
+
+#include <QHash>
+#include <QString>
+#include <QVariantMap>
+
+namespace OnlineAccountsDaemon {
+
+/* Keeps track of the resources used by each client registered with the
+ * ClientRegistry, and enforces the quotas set with these environment
+ * variables (unset or 0 means no limit):
+ *
+ *   OAD_QUOTA_CALLS_PER_MINUTE: D-Bus method calls
+ *   OAD_QUOTA_CPU_MS_PER_MINUTE: CPU time spent in the method handlers
+ *   OAD_QUOTA_IN_FLIGHT: calls waiting for signond or for the user
+ *   OAD_QUOTA_SIGNOND_SESSIONS: open signond sessions
+ *
+ * Nothing is collected unless a quota is set or accounting is enabled. */
+class ClientAccounting
+{
+public:
+    static ClientAccounting *instance();
+
+    void setEnabled(bool enabled) { m_isEnabled = enabled; }
+    bool isEnabled() const { return m_isEnabled || hasQuotas(); }
+    bool hasQuotas() const;
+
+    /* Returns false, and sets the reason, if the call must be throttled.
+     * Delayed calls, which can open a signond session, are accounted as in
+     * flight until callFinished(); the other calls are replied to right
+     * away, and only count towards the per-minute quotas. */
+    bool admitCall(uint clientId, const QString &clientName,
+                   const QString &securityContext,
+                   bool isDelayed, QString *reason);
+    void callFinished(uint clientId);
+
+    void addHandlerTime(uint clientId, qint64 cpuNsecs);
+    void signondSessionOpened(uint clientId);
+    void signondSessionClosed(uint clientId);
+
+    void removeClient(uint clientId);
+
+    QVariantMap toMap() const;
+
+private:
+    ClientAccounting();
+
+    struct ClientUsage {
+        ClientUsage(): calls(0), throttledCalls(0), cpuNsecs(0),
+            inFlight(0), inFlightPeak(0), signondSessions(0),
+            windowStart(0), windowCalls(0), windowCpuNsecs(0) {}
+        QString name;
+        QString securityContext;
+        quint32 calls;
+        quint32 throttledCalls;
+        qint64 cpuNsecs;
+        int inFlight;
+        int inFlightPeak;
+        int signondSessions;
+        /* Usage within the current one-minute window */
+        qint64 windowStart;
+        quint32 windowCalls;
+        qint64 windowCpuNsecs;
+    };
+
+    void updateWindow(ClientUsage &usage, qint64 now) const;
+
+    bool m_isEnabled;
+    quint32 m_maxCallsPerMinute;
+    qint64 m_maxCpuNsecsPerMinute;
+    int m_maxInFlight;
+    int m_maxSignondSessions;
+    QHash<uint,ClientUsage> m_clients;
+};
+
+/* Charges a client with the CPU time used by the calling thread while the
+ * scope is alive */
+class ClientCpuScope
+{
+public:
+    explicit ClientCpuScope(uint clientId);
+    ~ClientCpuScope();
+
+    void setClientId(uint clientId) { m_clientId = clientId; }
+
+private:
+    Q_DISABLE_COPY(ClientCpuScope)
+    uint m_clientId;
+    qint64 m_startNsecs;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_CLIENT_ACCOUNTING_H
@@ -24,12 +24,15 @@
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusMessage>
+#include <QDBusPendingCall>
+#include <QDBusPendingReply>
 #include <QDBusReply>
-#include <QDBusServiceWatcher>
 #include <QDebug>
 #include <QHash>
+#include <QList>
 #include <QVariantMap>
 #include <sys/apparmor.h>
+#include "heap_accounting.h"
 
 using namespace OnlineAccountsDaemon;
 
@@ -44,17 +47,21 @@ public:
     ClientRegistryPrivate(ClientRegistry *q);
 
     void registerClient(const QString &client);
-    QString getSecurityContext(const QString &client) const;
+    ClientInfo getClientInfo(const QString &client) const;
     pid_t getPid(const QString &client) const;
+    static void parseSecurityContext(ClientInfo &info);
+    QStringList filterActiveClients(const QStringList &clients) const;
 
 private Q_SLOTS:
+    void onNameOwnerChanged(const QString &name, const QString &oldOwner,
+                            const QString &newOwner);
     void onServiceUnregistered(const QString &client);
 
 private:
     static ClientRegistry *m_instance;
     QDBusConnection m_connection;
-    QDBusServiceWatcher m_watcher;
-    QHash<QString,QString> m_clientContexts;
+    QHash<QString,ClientInfo> m_clientInfos;
+    uint m_lastClientId;
     ClientRegistry *q_ptr;
 };
 
@@ -65,28 +72,40 @@ ClientRegistry *ClientRegistryPrivate::m_instance = 0;
 ClientRegistryPrivate::ClientRegistryPrivate(ClientRegistry *q):
     QObject(q),
     m_connection(QDBusConnection::sessionBus()),
+    m_lastClientId(0),
     q_ptr(q)
 {
-    m_watcher.setConnection(m_connection);
-    QObject::connect(&m_watcher, SIGNAL(serviceUnregistered(const QString&)),
-                     this, SLOT(onServiceUnregistered(const QString&)));
+    /* A single subscription for all clients: a QDBusServiceWatcher would add
+     * a match rule on the bus for each of them. */
+    m_connection.connect(QStringLiteral("org.freedesktop.DBus"),
+                         QStringLiteral("/org/freedesktop/DBus"),
+                         QStringLiteral("org.freedesktop.DBus"),
+                         QStringLiteral("NameOwnerChanged"),
+                         this,
+                         SLOT(onNameOwnerChanged(const QString&,
+                                                 const QString&,
+                                                 const QString&)));
 }
 
 void ClientRegistryPrivate::registerClient(const QString &client)
 {
     Q_Q(ClientRegistry);
 
-    if (m_clientContexts.contains(client)) return;
+    if (m_clientInfos.contains(client)) return;
 
-    bool wasEmpty = m_clientContexts.isEmpty();
-    m_clientContexts.insert(client, getSecurityContext(client));
-    m_watcher.addWatchedService(client);
+    HeapScope heapScope(HeapAccounting::ClientRegistryData);
+
+    bool wasEmpty = m_clientInfos.isEmpty();
+    ClientInfo info = getClientInfo(client);
+    /* Unique bus names are never reused, and neither are our IDs */
+    info.id = ++m_lastClientId;
+    m_clientInfos.insert(client, info);
     if (wasEmpty) {
         Q_EMIT q->hasClientsChanged();
     }
 }
 
-QString ClientRegistryPrivate::getSecurityContext(const QString &client) const
+ClientInfo ClientRegistryPrivate::getClientInfo(const QString &client) const
 {
     QString dbusService = qEnvironmentVariableIsEmpty("OAD_TESTING") ?
         "org.freedesktop.DBus" : "mocked.org.freedesktop.dbus";
@@ -98,23 +117,32 @@ QString ClientRegistryPrivate::getSecurityContext(const QString &client) const
     msg << client;
     QDBusReply<QVariantMap> reply = m_connection.call(msg, QDBus::Block);
 
-    QString context;
+    ClientInfo info;
     if (reply.isValid()) {
         QVariantMap map = reply.value();
         QByteArray label = map.value("LinuxSecurityLabel").toByteArray();
         if (!label.isEmpty()) {
             aa_splitcon(label.data(), NULL);
-            context = QString::fromUtf8(label);
+            info.securityContext = QString::fromUtf8(label);
         }
+        info.pid = pid_t(map.value("ProcessID").toUInt());
     } else {
         QDBusError error = reply.error();
         qWarning() << "Error getting app ID:" << error.name() <<
             error.message();
-        context = QStringLiteral("unconfined");
+        info.securityContext = QStringLiteral("unconfined");
+    }
+
+    /* Not all bus implementations report the ProcessID in the credentials;
+     * only in that case make a separate call for it. */
+    if (info.pid == 0) {
+        info.pid = getPid(client);
     }
-    qDebug() << "Client security context:" << context;
+    parseSecurityContext(info);
+    qDebug() << "Client security context:" << info.securityContext <<
+        "PID:" << info.pid;
 
-    return context;
+    return info;
 }
 
 pid_t ClientRegistryPrivate::getPid(const QString &client) const
@@ -123,13 +151,75 @@ pid_t ClientRegistryPrivate::getPid(const QString &client) const
     return pid_t(reply.value());
 }
 
+void ClientRegistryPrivate::parseSecurityContext(ClientInfo &info)
+{
+    const QString &context = info.securityContext;
+    info.unconfined = (context == "unconfined");
+    if (context.isEmpty() || info.unconfined) return;
+
+    /* Confined apps have a "<package>_<app>_<version>" label: extract the
+     * click package name and the application ID from it. */
+    QStringList parts = context.split('_');
+    if (parts.count() < 2) {
+        qWarning() << "AppArmor context doesn't contain package ID: " << context;
+        return;
+    }
+    info.packageId = parts.first();
+    if (parts.count() == 3) {
+        info.applicationId = QStringList(parts.mid(0, 2)).join('_');
+    }
+}
+
+QStringList
+ClientRegistryPrivate::filterActiveClients(const QStringList &clients) const
+{
+    /* Issue all the NameHasOwner calls at once, so that we only wait for
+     * one round trip to the bus instead of one per client. */
+    QList<QDBusPendingCall> calls;
+    Q_FOREACH(const QString &client, clients) {
+        QDBusMessage msg =
+            QDBusMessage::createMethodCall("org.freedesktop.DBus",
+                                           "/org/freedesktop/DBus",
+                                           "org.freedesktop.DBus",
+                                           "NameHasOwner");
+        msg << client;
+        calls.append(m_connection.asyncCall(msg));
+    }
+
+    QStringList activeClients;
+    for (int i = 0; i < calls.count(); i++) {
+        QDBusPendingReply<bool> reply(calls[i]);
+        reply.waitForFinished();
+        if (reply.isValid() && reply.value()) {
+            activeClients.append(clients[i]);
+        }
+    }
+    return activeClients;
+}
+
+void ClientRegistryPrivate::onNameOwnerChanged(const QString &name,
+                                               const QString &oldOwner,
+                                               const QString &newOwner)
+{
+    Q_UNUSED(oldOwner);
+
+    if (newOwner.isEmpty() && m_clientInfos.contains(name)) {
+        onServiceUnregistered(name);
+    }
+}
+
 void ClientRegistryPrivate::onServiceUnregistered(const QString &client)
 {
     Q_Q(ClientRegistry);
 
     qDebug() << "Client disappeared:" << client;
-    m_clientContexts.remove(client);
-    if (m_clientContexts.isEmpty()) {
+    uint clientId;
+    {
+        HeapScope heapScope(HeapAccounting::ClientRegistryData);
+        clientId = m_clientInfos.take(client).id;
+    }
+    Q_EMIT q->clientUnregistered(clientId);
+    if (m_clientInfos.isEmpty()) {
         Q_EMIT q->hasClientsChanged();
     }
 }
@@ -172,37 +262,42 @@ void ClientRegistry::registerClient(const QString &client)
 QStringList ClientRegistry::clients() const
 {
     Q_D(const ClientRegistry);
-    return d->m_clientContexts.keys();
+    return d->m_clientInfos.keys();
 }
 
 void ClientRegistry::registerActiveClients(const QStringList &clients)
 {
     Q_D(const ClientRegistry);
-    QStringList activeServices =
-        d->m_connection.interface()->registeredServiceNames().value();
-    Q_FOREACH(const QString &client, clients) {
-        if (activeServices.contains(client)) {
-            registerClient(client);
-        }
+    Q_FOREACH(const QString &client, d->filterActiveClients(clients)) {
+        registerClient(client);
     }
 }
 
-QString ClientRegistry::clientSecurityContext(const QString &client) const
+uint ClientRegistry::clientId(const QString &client) const
 {
     Q_D(const ClientRegistry);
-    QHash<QString,QString>::const_iterator i =
-        d->m_clientContexts.find(client);
-    if (i != d->m_clientContexts.constEnd()) {
+    return d->m_clientInfos.value(client).id;
+}
+
+ClientInfo ClientRegistry::clientInfo(const QString &client) const
+{
+    Q_D(const ClientRegistry);
+    QHash<QString,ClientInfo>::const_iterator i = d->m_clientInfos.find(client);
+    if (i != d->m_clientInfos.constEnd()) {
         return i.value();
     }
 
-    return d->getSecurityContext(client);
+    return d->getClientInfo(client);
+}
+
+QString ClientRegistry::clientSecurityContext(const QString &client) const
+{
+    return clientInfo(client).securityContext;
 }
 
 pid_t ClientRegistry::clientPid(const QString &client) const
 {
-    Q_D(const ClientRegistry);
-    return d->getPid(client);
+    return clientInfo(client).pid;
 }
 
 #include "client_registry.moc"
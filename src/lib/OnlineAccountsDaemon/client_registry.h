@@ -30,6 +30,18 @@ class QDBusMessage;
 
 namespace OnlineAccountsDaemon {
 
+struct ClientInfo {
+    ClientInfo(): id(0), unconfined(false), pid(0) {}
+
+    /* Small integer identifying a registered client; 0 if not registered */
+    uint id;
+    QString securityContext;
+    bool unconfined;
+    QString packageId;
+    QString applicationId;
+    pid_t pid;
+};
+
 class ClientRegistryPrivate;
 class ClientRegistry: public QObject
 {
@@ -47,11 +59,14 @@ public:
     QStringList clients() const;
     bool hasClients() const { return !clients().isEmpty(); }
 
+    uint clientId(const QString &client) const;
+    ClientInfo clientInfo(const QString &client) const;
     QString clientSecurityContext(const QString &client) const;
     pid_t clientPid(const QString &client) const;
 
 Q_SIGNALS:
     void hasClientsChanged();
+    void clientUnregistered(uint clientId);
 
 private:
     ClientRegistry();
@@ -27,6 +27,9 @@
 #define ONLINE_ACCOUNTS_MANAGER_PATH "/com/ubuntu/OnlineAccounts/Manager"
 #define ONLINE_ACCOUNTS_MANAGER_INTERFACE ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME
 
+/* Diagnostics interface, on the manager object */
+#define ONLINE_ACCOUNTS_DEBUG_INTERFACE "com.ubuntu.OnlineAccounts.Debug"
+
 /* Keys for the account info dictionary */
 #define ONLINE_ACCOUNTS_INFO_KEY_DISPLAY_NAME "displayName"
 #define ONLINE_ACCOUNTS_INFO_KEY_SERVICE_ID "serviceId"
@@ -55,6 +58,8 @@
     ONLINE_ACCOUNTS_ERROR_PREFIX "PermissionDenied"
 #define ONLINE_ACCOUNTS_ERROR_INTERACTION_REQUIRED \
     ONLINE_ACCOUNTS_ERROR_PREFIX "InteractionRequired"
+#define ONLINE_ACCOUNTS_ERROR_THROTTLED \
+    ONLINE_ACCOUNTS_ERROR_PREFIX "Throttled"
 
 /* Keys for the authentication data dictionaries */
 #define ONLINE_ACCOUNTS_AUTH_KEY_CLIENT_ID "ClientId"
@@ -0,0 +1,84 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug_adaptor.h"
+
+#include "call_statistics.h"
+#include "client_accounting.h"
+#include "heap_accounting.h"
+#include "manager.h"
+#include "startup_timings.h"
+#include "tracer.h"
+
+using namespace OnlineAccountsDaemon;
+
+DebugAdaptor::DebugAdaptor(Manager *parent):
+    QDBusAbstractAdaptor(parent)
+{
+}
+
+DebugAdaptor::~DebugAdaptor()
+{
+}
+
+bool DebugAdaptor::isEnabled()
+{
+    QByteArray value = qgetenv("OAD_DEBUG_INTERFACE");
+    return !value.isEmpty() && value != "0";
+}
+
+QVariantMap DebugAdaptor::GetStartupTimings()
+{
+    /* Microseconds since the process was started, for each phase reached so
+     * far */
+    QVariantMap timings;
+    Q_FOREACH(const StartupPhase &phase,
+              StartupTimings::instance()->phases()) {
+        timings.insert(phase.first, phase.second / 1000);
+    }
+    return timings;
+}
+
+QVariantMap DebugAdaptor::GetStatistics()
+{
+    QVariantMap statistics = CallStatistics::instance()->toMap();
+    Manager *manager = static_cast<Manager *>(parent());
+    statistics.insert("manager", manager->statistics());
+    return statistics;
+}
+
+QVariantMap DebugAdaptor::GetHeapUsage()
+{
+    /* Only collected when OAD_HEAP_ACCOUNTING is set */
+    return HeapAccounting::instance()->toMap();
+}
+
+QVariantMap DebugAdaptor::GetClientUsage()
+{
+    /* Resources used by the clients currently registered, and the quotas
+     * they are subject to */
+    return ClientAccounting::instance()->toMap();
+}
+
+QString DebugAdaptor::GetTrace()
+{
+    /* In the Chrome trace event format (chrome://tracing) */
+    return QString::fromUtf8(Tracer::instance()->toChromeTrace());
+}
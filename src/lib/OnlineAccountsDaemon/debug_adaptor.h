@@ -0,0 +1,74 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_DEBUG_ADAPTOR_H
+#define ONLINE_ACCOUNTS_DAEMON_DEBUG_ADAPTOR_H
+
+#include <QDBusAbstractAdaptor>
+#include <QVariantMap>
+#include "dbus_constants.h"
+
+namespace OnlineAccountsDaemon {
+
+class Manager;
+
+/* Diagnostics interface, only exported when the OAD_DEBUG_INTERFACE
+ * environment variable is set */
+class DebugAdaptor: public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", ONLINE_ACCOUNTS_DEBUG_INTERFACE)
+    Q_CLASSINFO("D-Bus Introspection", ""
+"  <interface name=\"" ONLINE_ACCOUNTS_DEBUG_INTERFACE "\">\n"
+"    <method name=\"GetStartupTimings\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"timings\"/>\n"
+"    </method>\n"
+"    <method name=\"GetStatistics\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"statistics\"/>\n"
+"    </method>\n"
+"    <method name=\"GetHeapUsage\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"heapUsage\"/>\n"
+"    </method>\n"
+"    <method name=\"GetClientUsage\">\n"
+"      <arg direction=\"out\" type=\"a{sv}\" name=\"clientUsage\"/>\n"
+"    </method>\n"
+"    <method name=\"GetTrace\">\n"
+"      <arg direction=\"out\" type=\"s\" name=\"chromeTrace\"/>\n"
+"    </method>\n"
+"  </interface>\n"
+        "")
+
+public:
+    explicit DebugAdaptor(Manager *parent);
+    ~DebugAdaptor();
+
+    static bool isEnabled();
+
+public Q_SLOTS:
+    QVariantMap GetStartupTimings();
+    QVariantMap GetStatistics();
+    QVariantMap GetHeapUsage();
+    QVariantMap GetClientUsage();
+    QString GetTrace();
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_DEBUG_ADAPTOR_H
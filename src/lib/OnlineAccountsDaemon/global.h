@@ -21,6 +21,7 @@
 #ifndef ONLINE_ACCOUNTS_DAEMON_GLOBAL_H
 #define ONLINE_ACCOUNTS_DAEMON_GLOBAL_H
 
+#include <QLoggingCategory>
 #include <QtGlobal>
 
 #if defined(BUILDING_ONLINE_ACCOUNTS_DAEMON)
@@ -29,4 +30,6 @@
 #  define OAD_EXPORT Q_DECL_IMPORT
 #endif
 
+Q_DECLARE_LOGGING_CATEGORY(DBG_ONLINE_ACCOUNTS_DAEMON)
+
 #endif // ONLINE_ACCOUNTS_DAEMON_GLOBAL_H
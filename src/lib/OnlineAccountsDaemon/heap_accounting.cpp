@@ -0,0 +1,123 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "heap_accounting.h"
+
+#include <malloc.h>
+
+using namespace OnlineAccountsDaemon;
+
+static const char *subsystemNames[HeapAccounting::SubsystemCount] = {
+    "ManagerPrivate",
+    "ClientRegistry",
+    "StateSaver",
+    "libaccounts",
+};
+
+static HeapAccounting *m_heapAccountingInstance = 0;
+
+HeapAccounting::HeapAccounting():
+    m_isEnabled(false),
+    m_initialHeap(0),
+    m_currentScope(0)
+{
+    QByteArray value = qgetenv("OAD_HEAP_ACCOUNTING");
+    m_isEnabled = !value.isEmpty() && value != "0";
+    if (m_isEnabled) {
+        m_initialHeap = heapInUse();
+    }
+
+    for (int i = 0; i < SubsystemCount; i++) {
+        m_bytes[i] = 0;
+    }
+}
+
+HeapAccounting *HeapAccounting::instance()
+{
+    if (!m_heapAccountingInstance) {
+        m_heapAccountingInstance = new HeapAccounting;
+    }
+    return m_heapAccountingInstance;
+}
+
+qint64 HeapAccounting::heapInUse()
+{
+    /* Chunks in use, plus the blocks allocated with mmap() */
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks) + qint64(info.hblkhd);
+#else
+    struct mallinfo info = mallinfo();
+    return qint64(uint(info.uordblks)) + qint64(uint(info.hblkhd));
+#endif
+#else
+    return 0;
+#endif
+}
+
+QVariantMap HeapAccounting::toMap() const
+{
+    if (!m_isEnabled) {
+        return QVariantMap {{ "enabled", false }};
+    }
+
+    QVariantMap subsystems;
+    qint64 attributed = 0;
+    for (int i = 0; i < SubsystemCount; i++) {
+        subsystems.insert(subsystemNames[i], m_bytes[i]);
+        attributed += m_bytes[i];
+    }
+
+    qint64 heap = heapInUse();
+    return QVariantMap {
+        { "enabled", true },
+        { "heapBytes", heap },
+        { "initialHeapBytes", m_initialHeap },
+        { "unattributedBytes", heap - m_initialHeap - attributed },
+        { "subsystems", subsystems },
+    };
+}
+
+HeapScope::HeapScope(HeapAccounting::Subsystem subsystem):
+    m_accounting(HeapAccounting::instance()),
+    m_subsystem(subsystem),
+    m_parent(0),
+    m_startHeap(0),
+    m_nestedBytes(0)
+{
+    if (Q_LIKELY(!m_accounting->isEnabled())) return;
+
+    m_parent = m_accounting->m_currentScope;
+    m_accounting->m_currentScope = this;
+    m_startHeap = HeapAccounting::heapInUse();
+}
+
+HeapScope::~HeapScope()
+{
+    if (Q_LIKELY(!m_accounting->isEnabled())) return;
+
+    qint64 bytes = HeapAccounting::heapInUse() - m_startHeap;
+    m_accounting->m_bytes[m_subsystem] += bytes - m_nestedBytes;
+    if (m_parent) {
+        m_parent->m_nestedBytes += bytes;
+    }
+    m_accounting->m_currentScope = m_parent;
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_HEAP_ACCOUNTING_H
+#define ONLINE_ACCOUNTS_DAEMON_HEAP_ACCOUNTING_H
+
+#include <QVariantMap>
+
+namespace OnlineAccountsDaemon {
+
+class HeapScope;
+
+/* Breaks down the heap usage of the daemon by subsystem. Measuring the heap
+ * is not cheap, so nothing is collected unless the OAD_HEAP_ACCOUNTING
+ * environment variable is set. */
+class HeapAccounting
+{
+public:
+    enum Subsystem {
+        ManagerData = 0,
+        ClientRegistryData,
+        StateSaverData,
+        LibaccountsData,
+        SubsystemCount
+    };
+
+    static HeapAccounting *instance();
+
+    bool isEnabled() const { return m_isEnabled; }
+
+    /* Bytes allocated from the heap by the whole process */
+    static qint64 heapInUse();
+
+    QVariantMap toMap() const;
+
+private:
+    friend class HeapScope;
+    HeapAccounting();
+
+    bool m_isEnabled;
+    qint64 m_initialHeap;
+    qint64 m_bytes[SubsystemCount];
+    HeapScope *m_currentScope;
+};
+
+/* Charges the given subsystem with the heap memory allocated, net of what was
+ * freed, while the scope is alive. Memory charged to a nested scope is not
+ * charged again to the enclosing one. */
+class HeapScope
+{
+public:
+    explicit HeapScope(HeapAccounting::Subsystem subsystem);
+    ~HeapScope();
+
+private:
+    Q_DISABLE_COPY(HeapScope)
+    HeapAccounting *m_accounting;
+    HeapAccounting::Subsystem m_subsystem;
+    HeapScope *m_parent;
+    qint64 m_startHeap;
+    qint64 m_nestedBytes;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_HEAP_ACCOUNTING_H
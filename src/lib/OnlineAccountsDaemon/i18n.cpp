@@ -21,6 +21,7 @@
 #define NO_TR_OVERRIDE
 #include "i18n.h"
 
+#include <clocale>
 #include <libintl.h>
 
 namespace OnlineAccountsDaemon {
@@ -31,4 +32,11 @@ QString translate(const QString &text, const QString &domain)
                                       text.toUtf8().constData()));
 }
 
+QByteArray translationLocale()
+{
+    /* gettext picks the language from LANGUAGE first, then from the
+     * LC_MESSAGES locale */
+    return qgetenv("LANGUAGE") + ':' + setlocale(LC_MESSAGES, NULL);
+}
+
 }  // namespace
@@ -21,11 +21,14 @@
 #ifndef ONLINE_ACCOUNTS_DAEMON_I18N_H
 #define ONLINE_ACCOUNTS_DAEMON_I18N_H
 
+#include <QByteArray>
 #include <QString>
 
 namespace OnlineAccountsDaemon {
 
 QString translate(const QString &text, const QString &domain);
+/* Identifies the language translate() returns strings in */
+QByteArray translationLocale();
 
 } // namespace
 
@@ -27,33 +27,135 @@
 #include <Accounts/Manager>
 #include <Accounts/Service>
 #include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QHash>
 #include <QPair>
 #include <QSet>
+#include <QStandardPaths>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
 #include "access_request.h"
 #include "authentication_request.h"
 #include "authenticator.h"
+#include "call_statistics.h"
+#include "client_accounting.h"
 #include "client_registry.h"
 #include "dbus_constants.h"
+#include "debug_adaptor.h"
+#include "heap_accounting.h"
 #include "i18n.h"
 #include "manager_adaptor.h"
+#include "startup_timings.h"
 #include "state_saver.h"
+#include "tracer.h"
 
 using namespace OnlineAccountsDaemon;
 
+Q_LOGGING_CATEGORY(DBG_ONLINE_ACCOUNTS_DAEMON, "OnlineAccountsDaemon",
+                   QtWarningMsg)
+
+namespace {
+
+/* How many accounts to restore in each main loop iteration */
+const int loadBatchSize = 10;
+
+QStringList catalogDirectories(const char *envVariable, const QString &subdir)
+{
+    /* Same lookup rules as libaccounts. All the candidate directories are
+     * listed, even those which don't exist yet, since they can be created at
+     * any time (for instance, when the first click app gets installed). */
+    QByteArray dir = qgetenv(envVariable);
+    if (!dir.isEmpty()) {
+        return QStringList(QDir(QString::fromUtf8(dir)).absolutePath());
+    }
+
+    QStringList dirs;
+    Q_FOREACH(const QString &dataDir,
+              QStandardPaths::standardLocations(
+                  QStandardPaths::GenericDataLocation)) {
+        dirs.append(QDir(dataDir + '/' + subdir).absolutePath());
+    }
+    return dirs;
+}
+
+/* The directory to watch in order to notice changes in the given one: the
+ * directory itself or, if it doesn't exist yet, its parent */
+QString watchablePath(const QString &path)
+{
+    QFileInfo info(path);
+    if (info.isDir()) return path;
+    QFileInfo parent(info.absolutePath());
+    return parent.isDir() ? parent.absoluteFilePath() : QString();
+}
+
+QString accountsDbDirectory()
+{
+    /* Same lookup rules as libaccounts */
+    QByteArray dir = qgetenv("ACCOUNTS");
+    if (!dir.isEmpty()) return QString::fromUtf8(dir);
+
+    return QStandardPaths::writableLocation(
+        QStandardPaths::GenericConfigLocation) + "/libaccounts-glib";
+}
+
+} // namespace
+
 namespace OnlineAccountsDaemon {
 
+typedef uint ClientId;
+typedef uint ServiceId;
+
 struct ActiveAccount {
     ActiveAccount(): accountService(0) {}
 
     bool isValid() const { return accountService != 0; }
+    void addClient(ClientId client) {
+        auto i = std::lower_bound(clients.begin(), clients.end(), client);
+        if (i == clients.end() || *i != client) clients.insert(i, client);
+    }
+    void removeClient(ClientId client) {
+        auto i = std::lower_bound(clients.begin(), clients.end(), client);
+        if (i != clients.end() && *i == client) clients.erase(i);
+    }
+
     Accounts::AccountService *accountService;
-    QSet<QString> clients;
+    QVector<ClientId> clients; // sorted
+};
+
+struct ActiveClient {
+    ActiveClient() {}
+    ActiveClient(const QString &busName,
+                 const Accounts::Application &application):
+        busName(busName), application(application) {}
+
+    QString busName;
+    Accounts::Application application;
+};
+
+typedef QPair<Accounts::AccountId,ServiceId> AccountCoordinates;
+typedef QHash<ClientId,ActiveClient> ClientMap;
+
+enum LoadStage {
+    NotLoaded = 0,
+    LoadingClients,
+    LoadingSavedAccounts,
+    ScanningAccounts,
+    Loaded,
 };
 
-typedef QPair<Accounts::AccountId,QString> AccountCoordinates;
-typedef QHash<QString,Accounts::Application> ClientMap;
+/* A GetAccounts() reply which was served before libaccounts was loaded */
+struct PendingReply {
+    ClientInfo client;
+    QString busName;
+    QString applicationId;
+    QList<AccountInfo> accounts;
+};
 
 class ManagerPrivate: public QObject
 {
@@ -64,19 +166,40 @@ public:
     ManagerPrivate(Manager *q);
     ~ManagerPrivate();
 
-    QString applicationIdFromServiceId(const QString &serviceId);
+    const QStringList &applicationsForService(const QString &serviceId);
+    QString applicationIdFromServiceId(const QString &serviceId,
+                                       const ClientInfo &client);
 
+    void updateCatalogWatches();
     void watchAccount(Accounts::Account *account);
+    void unwatchAccount(Accounts::Account *account);
     void handleNewAccountService(Accounts::Account *account,
                                  const Accounts::Service &service);
-    void loadActiveAccounts();
+    void loadClients();
+    void loadSavedAccount(const AccountInfo &accountInfo);
+    void scanAccount(Accounts::AccountId accountId);
+    Accounts::Account *loadAccount(Accounts::AccountId accountId);
+    void finishLoading();
+    void updateIdleState();
+    void watchEnabledAccounts();
     void saveState();
+    QByteArray databaseStamp() const;
+    void validateReplies();
+    void invalidateReplies();
+    void addClient(const ClientInfo &client, const QString &busName,
+                   const Accounts::Application &application);
+    void registerReply(const ClientInfo &client, const QString &busName,
+                       const QString &applicationId,
+                       const QList<AccountInfo> &accounts);
+    ServiceId internService(const QString &serviceName);
+    AccountCoordinates coordinates(const Accounts::AccountService *as);
     ActiveAccount &addActiveAccount(Accounts::AccountId accountId,
                                     const QString &serviceName,
-                                    const QString &client);
+                                    ClientId client);
     ActiveAccount &addActiveAccount(Accounts::AccountId accountId,
                                     const QString &serviceName,
-                                    const QStringList &clients);
+                                    const QVector<ClientId> &clients);
+    void removeClient(ClientId client);
 
     AccountInfo readAccountInfo(const Accounts::AccountService *as);
     QList<QVariantMap> buildServiceList(const Accounts::Application &app) const;
@@ -90,28 +213,56 @@ public:
     void requestAccess(const QString &serviceId,
                        const QVariantMap &parameters,
                        const CallContext &context);
-    bool canAccess(const QString &context, const QString &serviceId);
-
-    static QString applicationIdFromLabel(const QString &label);
+    bool canAccess(const ClientInfo &client, const QString &serviceId);
+    bool canActAs(const ClientInfo &client, const QString &applicationId);
+    const QSet<QString> &allowedServices(const QString &packageId);
 
     void notifyAccountChange(const ActiveAccount &account, uint change);
 
 private Q_SLOTS:
-    void onActiveContextsChanged();
+    void initialize();
+    void onLoadTimeout();
+    void onCallsIdleChanged();
+    void onAboutToSave();
+    void onServiceCatalogChanged(const QString &path);
     void onAccountServiceEnabled(bool enabled);
     void onAccountServiceChanged();
     void onAccountEnabled(const QString &serviceId, bool enabled);
     void onAccountCreated(Accounts::AccountId accountId);
+    void onAccountRemoved(Accounts::AccountId accountId);
+    void onClientUnregistered(uint clientId);
     void onLoadRequest(uint accountId, const QString &serviceId);
 
 private:
     ManagerAdaptor *m_adaptor;
-    Accounts::Manager m_manager;
+    Accounts::Manager *m_manager;
     StateSaver m_stateSaver;
     bool m_mustEmitNotifications;
     QHash<AccountCoordinates,ActiveAccount> m_activeAccounts;
     ClientMap m_clients;
-    QList<Accounts::Account*> m_watchedAccounts;
+    QHash<QString,ServiceId> m_serviceIds;
+    QSet<Accounts::Account*> m_watchedAccounts;
+    bool m_watchingEnabledAccounts;
+    int m_activeAccountsPeak;
+    int m_watchedAccountsPeak;
+    QFileSystemWatcher m_catalogWatcher;
+    QHash<QString,QSet<QString> > m_allowedServices;
+    QHash<QString,QStringList> m_serviceApplications;
+    QStringList m_catalogDirs;
+    QStringList m_watchedCatalogDirs;
+    QStringList m_existingCatalogDirs;
+    QByteArray m_repliesStamp;
+    AccountsReplies m_replies;
+    QList<PendingReply> m_pendingReplies;
+    LoadStage m_loadStage;
+    QTimer m_loadTimer;
+    QList<AccountInfo> m_accountsToLoad;
+    Accounts::AccountIdList m_accountsToScan;
+    QSet<AccountCoordinates> m_knownAccounts;
+    ActivationStats m_activationStats;
+    qint64 m_msecsSinceIdleExit;
+    quint32 m_callsIdleChanges;
+    quint32 m_stateSaves;
     bool m_isIdle;
     Manager *q_ptr;
 };
@@ -121,72 +272,264 @@ private:
 ManagerPrivate::ManagerPrivate(Manager *q):
     QObject(q),
     m_adaptor(new ManagerAdaptor(q)),
+    m_manager(0),
     m_mustEmitNotifications(false),
+    m_watchingEnabledAccounts(false),
+    m_activeAccountsPeak(0),
+    m_watchedAccountsPeak(0),
+    m_loadStage(NotLoaded),
+    m_msecsSinceIdleExit(-1),
+    m_callsIdleChanges(0),
+    m_stateSaves(0),
     m_isIdle(true),
     q_ptr(q)
 {
-    CallContextCounter *counter = CallContextCounter::instance();
-    QObject::connect(counter, SIGNAL(activeContextsChanged()),
-                     this, SLOT(onActiveContextsChanged()));
+    /* The members are constructed, so the state file has been read */
+    StartupTimings::instance()->mark("stateLoaded");
 
-    loadActiveAccounts();
+    if (DebugAdaptor::isEnabled()) {
+        new DebugAdaptor(q);
+        CallStatistics::instance()->setEnabled(true);
+        ClientAccounting::instance()->setEnabled(true);
+    }
 
-    QObject::connect(&m_manager, SIGNAL(accountCreated(Accounts::AccountId)),
-                     this, SLOT(onAccountCreated(Accounts::AccountId)));
+    CallContextCounter *counter = CallContextCounter::instance();
+    QObject::connect(counter, SIGNAL(isIdleChanged()),
+                     this, SLOT(onCallsIdleChanged()));
+
+    m_watchedCatalogDirs =
+        catalogDirectories("AG_SERVICES", "accounts/services") +
+        catalogDirectories("AG_APPLICATIONS", "accounts/applications");
+    m_watchedCatalogDirs.removeDuplicates();
+    updateCatalogWatches();
+    QObject::connect(&m_catalogWatcher, SIGNAL(directoryChanged(const QString&)),
+                     this, SLOT(onServiceCatalogChanged(const QString&)));
+    m_catalogDirs = m_watchedCatalogDirs +
+        catalogDirectories("AG_PROVIDERS", "accounts/providers");
+
+    QObject::connect(&m_stateSaver, SIGNAL(aboutToSave()),
+                     this, SLOT(onAboutToSave()));
+    QObject::connect(ClientRegistry::instance(),
+                     SIGNAL(clientUnregistered(uint)),
+                     this, SLOT(onClientUnregistered(uint)));
+
+    /* Record this activation; the time elapsed since the previous run ended
+     * tells whether we are being respawned too often */
+    m_activationStats = m_stateSaver.activationStats();
+    if (m_activationStats.lastIdleExit > 0) {
+        m_msecsSinceIdleExit = QDateTime::currentMSecsSinceEpoch() -
+            m_activationStats.lastIdleExit;
+    }
+    m_activationStats.activations++;
+    m_activationStats.lastIdleExit = 0;
+    m_stateSaver.setActivationStats(m_activationStats);
+    qDebug() << "Activation" << m_activationStats.activations <<
+        "idle exits:" << m_activationStats.idleExits;
+
+    m_loadTimer.setInterval(0);
+    QObject::connect(&m_loadTimer, SIGNAL(timeout()),
+                     this, SLOT(onLoadTimeout()));
+
+    /* If the accounts DB didn't change since we last ran, the replies we
+     * sent back then are still good: serve them without waiting for
+     * libaccounts to be loaded. */
+    m_repliesStamp = m_stateSaver.accountsRepliesStamp();
+    m_replies = m_stateSaver.accountsReplies();
+    if (m_replies.isEmpty() || databaseStamp() != m_repliesStamp) {
+        invalidateReplies();
+        /* Don't hold back the registration of the bus name */
+        QTimer::singleShot(0, this, SLOT(initialize()));
+    } else {
+        /* libaccounts is needed anyway, to hear about account changes even
+         * if no client calls us; but let the calls which are already queued
+         * be served from the snapshot first. */
+        QTimer::singleShot(0, this, [this]() {
+            QTimer::singleShot(0, this, SLOT(initialize()));
+        });
+    }
 }
 
 ManagerPrivate::~ManagerPrivate()
 {
+    finishLoading();
     saveState();
 }
 
-void ManagerPrivate::onActiveContextsChanged()
+void ManagerPrivate::initialize()
+{
+    if (m_manager) return;
+
+    {
+        HeapScope heapScope(HeapAccounting::LibaccountsData);
+        m_manager = new Accounts::Manager(this);
+    }
+    StartupTimings::instance()->mark("accountsManagerCreated");
+
+    QObject::connect(m_manager, SIGNAL(accountCreated(Accounts::AccountId)),
+                     this, SLOT(onAccountCreated(Accounts::AccountId)));
+    QObject::connect(m_manager, SIGNAL(accountRemoved(Accounts::AccountId)),
+                     this, SLOT(onAccountRemoved(Accounts::AccountId)));
+
+    /* The active accounts are restored from the event loop; calls can
+     * already be served in the meantime. */
+    m_loadStage = LoadingClients;
+    m_loadTimer.start();
+    updateIdleState();
+
+    /* Now that we can, start tracking the accounts we already sent out */
+    Q_FOREACH(const PendingReply &reply, m_pendingReplies) {
+        registerReply(reply.client, reply.busName, reply.applicationId,
+                      reply.accounts);
+    }
+    m_pendingReplies.clear();
+}
+
+void ManagerPrivate::updateIdleState()
 {
     Q_Q(Manager);
     CallContextCounter *counter = CallContextCounter::instance();
-    if (counter->activeContexts() == 0) {
-        m_isIdle = true;
-        Q_EMIT q->isIdleChanged();
-    } else if (m_isIdle) {
-        m_isIdle = false;
+    bool isIdle = counter->isIdle() &&
+        (m_loadStage == NotLoaded || m_loadStage == Loaded);
+    if (isIdle != m_isIdle) {
+        m_isIdle = isIdle;
         Q_EMIT q->isIdleChanged();
     }
 }
 
-QString ManagerPrivate::applicationIdFromServiceId(const QString &serviceId)
+void ManagerPrivate::onCallsIdleChanged()
+{
+    m_callsIdleChanges++;
+    updateIdleState();
+}
+
+void ManagerPrivate::onAboutToSave()
+{
+    saveState();
+    m_stateSaves++;
+}
+
+void ManagerPrivate::onServiceCatalogChanged(const QString &path)
+{
+    /* The parent of a missing catalog directory is only watched to see the
+     * catalog directory being created: ignore its other changes */
+    if (!m_watchedCatalogDirs.contains(path)) {
+        QStringList existingDirs;
+        Q_FOREACH(const QString &dir, m_watchedCatalogDirs) {
+            if (QFileInfo(dir).isDir()) existingDirs.append(dir);
+        }
+        if (existingDirs == m_existingCatalogDirs) return;
+    }
+
+    /* A catalog directory might have been created or removed */
+    updateCatalogWatches();
+
+    /* Services or applications might have been installed or removed */
+    m_allowedServices.clear();
+    m_serviceApplications.clear();
+    invalidateReplies();
+}
+
+const QStringList &
+ManagerPrivate::applicationsForService(const QString &serviceId)
+{
+    auto i = m_serviceApplications.find(serviceId);
+    bool found = i != m_serviceApplications.end();
+    CallStatistics::instance()->addCacheLookup("serviceApplications", found);
+    if (i == m_serviceApplications.end()) {
+        QStringList applications;
+        Accounts::Service service = m_manager->service(serviceId);
+        if (service.isValid()) {
+            const auto apps = m_manager->applicationList(service);
+            for (const Accounts::Application &app: apps) {
+                applications.append(app.name());
+            }
+        }
+        i = m_serviceApplications.insert(serviceId, applications);
+    }
+    return i.value();
+}
+
+QString ManagerPrivate::applicationIdFromServiceId(const QString &serviceId,
+                                                   const ClientInfo &client)
 {
-    Accounts::Service service = m_manager.service(serviceId);
-    Accounts::ApplicationList apps = m_manager.applicationList(service);
+    const QStringList &apps = applicationsForService(serviceId);
     if (apps.isEmpty()) return QString();
 
-    /* TODO: to figure out the correct app, take the security context into
-     * account */
-    return apps.first().name();
+    /* Confined clients can only be one of the applications from their own
+     * package: prefer the one matching their security context, and never
+     * pick an application from a different package. */
+    if (!client.applicationId.isEmpty() &&
+        apps.contains(client.applicationId)) {
+        return client.applicationId;
+    }
+    if (!client.packageId.isEmpty()) {
+        QString prefix = client.packageId + '_';
+        for (const QString &app: apps) {
+            if (app.startsWith(prefix)) return app;
+        }
+    }
+
+    if (!client.unconfined) return QString();
+    return apps.first();
+}
+
+void ManagerPrivate::updateCatalogWatches()
+{
+    /* Directories which don't exist yet are watched through their parent,
+     * so that we notice when they get created */
+    QStringList paths;
+    m_existingCatalogDirs.clear();
+    Q_FOREACH(const QString &dir, m_watchedCatalogDirs) {
+        QString path = watchablePath(dir);
+        if (path == dir) m_existingCatalogDirs.append(dir);
+        if (!path.isEmpty() && !paths.contains(path)) paths.append(path);
+    }
+
+    QStringList watched = m_catalogWatcher.directories();
+    Q_FOREACH(const QString &path, watched) {
+        if (!paths.contains(path)) m_catalogWatcher.removePath(path);
+    }
+    Q_FOREACH(const QString &path, paths) {
+        if (!watched.contains(path)) m_catalogWatcher.addPath(path);
+    }
 }
 
 void ManagerPrivate::watchAccount(Accounts::Account *account)
 {
     if (m_watchedAccounts.contains(account)) return;
 
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
     QObject::connect(account, SIGNAL(enabledChanged(const QString &, bool)),
                      this, SLOT(onAccountEnabled(const QString &, bool)));
-    m_watchedAccounts.append(account);
+    m_watchedAccounts.insert(account);
+    m_watchedAccountsPeak = qMax(m_watchedAccountsPeak,
+                                 m_watchedAccounts.count());
+}
+
+void ManagerPrivate::unwatchAccount(Accounts::Account *account)
+{
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
+    if (!m_watchedAccounts.remove(account)) return;
+
+    QObject::disconnect(account, 0, this, 0);
 }
 
 void ManagerPrivate::handleNewAccountService(Accounts::Account *account,
                                              const Accounts::Service &service)
 {
-    AccountCoordinates coords(account->id(), service.name());
+    AccountCoordinates coords(account->id(), internService(service.name()));
     if (m_activeAccounts.contains(coords)) {
         /* This event is also received via the AccountService instance; we'll
          * handle it from there. */
         return;
     }
 
-    QStringList interestedClients;
+    QVector<ClientId> interestedClients;
     for (auto i = m_clients.constBegin();
          i != m_clients.constEnd(); i++) {
-        const Accounts::Application &application = i.value();
+        const Accounts::Application &application = i.value().application;
 
         if (!application.serviceUsage(service).isEmpty()) {
             interestedClients.append(i.key());
@@ -198,7 +541,7 @@ void ManagerPrivate::handleNewAccountService(Accounts::Account *account,
                         ONLINE_ACCOUNTS_INFO_CHANGE_ENABLED);
 }
 
-void ManagerPrivate::loadActiveAccounts()
+void ManagerPrivate::loadClients()
 {
     QSet<Client> oldClients = m_stateSaver.clients().toSet();
     ClientRegistry *clientRegistry = ClientRegistry::instance();
@@ -207,72 +550,157 @@ void ManagerPrivate::loadActiveAccounts()
         oldClientNames.append(client.first);
     }
     clientRegistry->registerActiveClients(oldClientNames);
+    StartupTimings::instance()->mark("activeClientsRegistered");
 
-    /* Build the table of the active clients */
-    QStringList activeClientNames = clientRegistry->clients();
+    /* Build the table of the active clients; those which already called us
+     * are up to date */
     Q_FOREACH(const Client &client, oldClients) {
-        if (activeClientNames.contains(client.first)) {
-            m_clients[client.first] = m_manager.application(client.second);
+        ClientId clientId = clientRegistry->clientId(client.first);
+        if (clientId != 0 && !m_clients.contains(clientId)) {
+            Accounts::Application application =
+                m_manager->application(client.second);
+            m_clients.insert(clientId, ActiveClient(client.first, application));
         }
     }
+}
 
-    QList<AccountInfo> oldAccounts = m_stateSaver.accounts();
-    Q_FOREACH(const AccountInfo &accountInfo, oldAccounts) {
-        // If no clients are interested in this account, ignore it
-        Accounts::Service service =
-            m_manager.service(accountInfo.serviceId());
-        if (Q_UNLIKELY(!service.isValid())) continue;
+void ManagerPrivate::loadSavedAccount(const AccountInfo &accountInfo)
+{
+    Accounts::Service service = m_manager->service(accountInfo.serviceId());
+    if (Q_UNLIKELY(!service.isValid())) return;
 
-        QStringList clients;
-        for (auto i = m_clients.constBegin();
-             i != m_clients.constEnd(); i++) {
-            const Accounts::Application &application = i.value();
-            if (!application.serviceUsage(service).isEmpty()) {
-                clients.append(i.key());
-            }
-        }
-        if (clients.isEmpty()) {
-            // no one is interested in this account
-            continue;
+    AccountCoordinates coords(accountInfo.accountId,
+                              internService(service.name()));
+    m_knownAccounts.insert(coords);
+
+    // If no clients are interested in this account, ignore it
+    QVector<ClientId> clients;
+    for (auto i = m_clients.constBegin(); i != m_clients.constEnd(); i++) {
+        const Accounts::Application &application = i.value().application;
+        if (!application.serviceUsage(service).isEmpty()) {
+            clients.append(i.key());
         }
+    }
+    if (clients.isEmpty()) return;
 
-        ActiveAccount &activeAccount =
-            addActiveAccount(accountInfo.accountId, service.name(), clients);
-        if (Q_UNLIKELY(!activeAccount.isValid())) continue;
+    ActiveAccount &activeAccount =
+        addActiveAccount(accountInfo.accountId, service.name(), clients);
+    if (!activeAccount.isValid()) {
+        // the account got deleted while this daemon was not running
+        m_activeAccounts.remove(coords);
+        m_adaptor->notifyAccountChange(accountInfo,
+                                       ONLINE_ACCOUNTS_INFO_CHANGE_DISABLED);
+        return;
+    }
 
-        if (!activeAccount.accountService->isEnabled()) {
-            // the account got disabled while this daemon was not running
+    if (!activeAccount.accountService->isEnabled()) {
+        // the account got disabled while this daemon was not running
+        notifyAccountChange(activeAccount,
+                            ONLINE_ACCOUNTS_INFO_CHANGE_DISABLED);
+    } else {
+        AccountInfo newAccountInfo =
+            readAccountInfo(activeAccount.accountService);
+        if (newAccountInfo.details != accountInfo.details) {
             notifyAccountChange(activeAccount,
-                                ONLINE_ACCOUNTS_INFO_CHANGE_DISABLED);
-        } else {
-            AccountInfo newAccountInfo =
-                readAccountInfo(activeAccount.accountService);
-            if (newAccountInfo.details != accountInfo.details) {
-                notifyAccountChange(activeAccount,
-                                    ONLINE_ACCOUNTS_INFO_CHANGE_UPDATED);
-            }
+                                ONLINE_ACCOUNTS_INFO_CHANGE_UPDATED);
         }
     }
+}
 
-    /* Last, go through all active clients and see if there are new accounts
-     * for any of them. */
-    Q_FOREACH(Accounts::AccountId accountId, m_manager.accountListEnabled()) {
-        Accounts::Account *account = m_manager.account(accountId);
-        if (Q_UNLIKELY(!account)) continue;
+void ManagerPrivate::scanAccount(Accounts::AccountId accountId)
+{
+    Accounts::Account *account = loadAccount(accountId);
+    if (Q_UNLIKELY(!account)) return;
 
-        watchAccount(account);
-        Q_FOREACH(Accounts::Service service, account->enabledServices()) {
-            handleNewAccountService(account, service);
+    watchAccount(account);
+    Q_FOREACH(Accounts::Service service, account->enabledServices()) {
+        /* Accounts from the saved snapshot are not new to our clients */
+        AccountCoordinates coords(accountId, internService(service.name()));
+        if (m_knownAccounts.contains(coords)) continue;
+
+        handleNewAccountService(account, service);
+    }
+}
+
+Accounts::Account *ManagerPrivate::loadAccount(Accounts::AccountId accountId)
+{
+    /* The account objects are owned and cached by the Accounts::Manager */
+    HeapScope heapScope(HeapAccounting::LibaccountsData);
+    return m_manager->account(accountId);
+}
+
+void ManagerPrivate::onLoadTimeout()
+{
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
+    /* Restore a few accounts at a time, so that incoming calls don't have to
+     * wait for all of them */
+    switch (m_loadStage) {
+    case LoadingClients:
+        loadClients();
+        m_accountsToLoad = m_stateSaver.accounts();
+        m_loadStage = LoadingSavedAccounts;
+        break;
+    case LoadingSavedAccounts:
+        for (int n = 0; n < loadBatchSize && !m_accountsToLoad.isEmpty(); n++) {
+            loadSavedAccount(m_accountsToLoad.takeFirst());
+        }
+        if (m_accountsToLoad.isEmpty()) {
+            /* Last, go through all the accounts and see if there are new
+             * ones for any of our clients. */
+            m_accountsToScan = m_manager->accountListEnabled();
+            m_loadStage = ScanningAccounts;
+        }
+        break;
+    case ScanningAccounts:
+        for (int n = 0; n < loadBatchSize && !m_accountsToScan.isEmpty(); n++) {
+            scanAccount(m_accountsToScan.takeFirst());
+        }
+        if (m_accountsToScan.isEmpty()) {
+            validateReplies();
+            m_knownAccounts.clear();
+            m_watchingEnabledAccounts = true;
+            m_loadStage = Loaded;
+            m_loadTimer.stop();
+            StartupTimings::instance()->mark("activeAccountsLoaded");
+            m_stateSaver.scheduleSave();
+            updateIdleState();
         }
+        break;
+    default:
+        m_loadTimer.stop();
     }
 }
 
+void ManagerPrivate::finishLoading()
+{
+    while (m_manager && m_loadStage != Loaded) {
+        onLoadTimeout();
+    }
+}
+
+void ManagerPrivate::watchEnabledAccounts()
+{
+    if (m_watchingEnabledAccounts) return;
+
+    Q_FOREACH(Accounts::AccountId accountId, m_manager->accountListEnabled()) {
+        Accounts::Account *account = loadAccount(accountId);
+        if (Q_LIKELY(account)) watchAccount(account);
+    }
+    m_watchingEnabledAccounts = true;
+}
+
 void ManagerPrivate::saveState()
 {
+    /* Until all of it is loaded, the saved state is still current */
+    if (m_loadStage != Loaded) return;
+
+    HeapScope heapScope(HeapAccounting::StateSaverData);
+
     QList<Client> clients;
     for (auto i = m_clients.constBegin(); i != m_clients.constEnd(); i++) {
-        const Accounts::Application &application = i.value();
-        clients.append(Client(i.key(), application.name()));
+        const ActiveClient &client = i.value();
+        clients.append(Client(client.busName, client.application.name()));
     }
     m_stateSaver.setClients(clients);
 
@@ -283,6 +711,105 @@ void ManagerPrivate::saveState()
         accounts.append(readAccountInfo(activeAccount.accountService));
     }
     m_stateSaver.setAccounts(accounts);
+
+    /* Don't save replies which might not match the accounts DB anymore */
+    if (!m_replies.isEmpty() && databaseStamp() == m_repliesStamp) {
+        m_stateSaver.setAccountsReplies(m_repliesStamp, m_replies);
+    } else {
+        m_stateSaver.setAccountsReplies(QByteArray(), AccountsReplies());
+    }
+}
+
+QByteArray ManagerPrivate::databaseStamp() const
+{
+    /* The replies contain translated service names */
+    QByteArray stamp;
+    QDataStream stream(&stamp, QIODevice::WriteOnly);
+    stream << translationLocale();
+
+    /* Any write to the accounts DB or to the service catalog changes the
+     * modification time or the size of one of these. Catalog directories are
+     * stamped even if they don't exist, since creating them matters too; and
+     * since a file can be replaced without its directory's mtime changing
+     * within the timestamp resolution, the newest file is looked at too. */
+    Q_FOREACH(const QString &dir, m_catalogDirs) {
+        QFileInfo info(dir);
+        stream << dir << info.exists() <<
+            info.lastModified().toMSecsSinceEpoch();
+        if (!info.isDir()) continue;
+
+        qint64 newestFile = 0;
+        QFileInfoList files = QDir(dir).entryInfoList(QDir::Files);
+        Q_FOREACH(const QFileInfo &file, files) {
+            newestFile = qMax(newestFile,
+                              file.lastModified().toMSecsSinceEpoch());
+        }
+        stream << files.count() << newestFile;
+    }
+
+    QString dbDir = accountsDbDirectory();
+    QStringList dbFiles;
+    dbFiles << dbDir + "/accounts.db" << dbDir + "/accounts.db-wal";
+    Q_FOREACH(const QString &path, dbFiles) {
+        QFileInfo info(path);
+        stream << path << info.size() <<
+            info.lastModified().toMSecsSinceEpoch();
+    }
+    return stamp;
+}
+
+/* Once all the active accounts are loaded, their changes invalidate the
+ * replies; until then, the accounts DB must be looked at. */
+void ManagerPrivate::validateReplies()
+{
+    if (!m_replies.isEmpty() && databaseStamp() != m_repliesStamp) {
+        invalidateReplies();
+    }
+}
+
+void ManagerPrivate::invalidateReplies()
+{
+    m_replies.clear();
+    m_repliesStamp.clear();
+}
+
+void ManagerPrivate::addClient(const ClientInfo &client,
+                               const QString &busName,
+                               const Accounts::Application &application)
+{
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
+    auto i = m_clients.constFind(client.id);
+    if (i == m_clients.constEnd() ||
+        i->application.name() != application.name()) {
+        m_clients.insert(client.id, ActiveClient(busName, application));
+        m_stateSaver.scheduleSave();
+    }
+}
+
+void ManagerPrivate::registerReply(const ClientInfo &client,
+                                   const QString &busName,
+                                   const QString &applicationId,
+                                   const QList<AccountInfo> &accounts)
+{
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
+    if (!m_manager) {
+        PendingReply reply = { client, busName, applicationId, accounts };
+        m_pendingReplies.append(reply);
+        QTimer::singleShot(0, this, SLOT(initialize()));
+        return;
+    }
+
+    Accounts::Application application = m_manager->application(applicationId);
+    if (application.isValid() && canActAs(client, applicationId)) {
+        addClient(client, busName, application);
+    }
+
+    watchEnabledAccounts();
+    Q_FOREACH(const AccountInfo &account, accounts) {
+        addActiveAccount(account.accountId, account.serviceId(), client.id);
+    }
 }
 
 void ManagerPrivate::notifyAccountChange(const ActiveAccount &account,
@@ -290,38 +817,114 @@ void ManagerPrivate::notifyAccountChange(const ActiveAccount &account,
 {
     AccountInfo info = readAccountInfo(account.accountService);
     m_adaptor->notifyAccountChange(info, change);
+    invalidateReplies();
+    m_stateSaver.scheduleSave();
+}
+
+ServiceId ManagerPrivate::internService(const QString &serviceName)
+{
+    auto i = m_serviceIds.find(serviceName);
+    if (i == m_serviceIds.end()) {
+        i = m_serviceIds.insert(serviceName, m_serviceIds.count() + 1);
+    }
+    return i.value();
+}
+
+AccountCoordinates
+ManagerPrivate::coordinates(const Accounts::AccountService *as)
+{
+    return AccountCoordinates(as->account()->id(),
+                              internService(as->service().name()));
 }
 
 ActiveAccount &ManagerPrivate::addActiveAccount(Accounts::AccountId accountId,
                                                 const QString &serviceName,
-                                                const QString &client)
+                                                ClientId client)
 {
-    return addActiveAccount(accountId, serviceName, QStringList() << client);
+    return addActiveAccount(accountId, serviceName,
+                            QVector<ClientId>() << client);
 }
 
 ActiveAccount &ManagerPrivate::addActiveAccount(Accounts::AccountId accountId,
                                                 const QString &serviceName,
-                                                const QStringList &clients)
+                                                const QVector<ClientId> &clients)
 {
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
     ActiveAccount &activeAccount =
-        m_activeAccounts[AccountCoordinates(accountId, serviceName)];
-    activeAccount.clients += clients.toSet();
+        m_activeAccounts[AccountCoordinates(accountId,
+                                            internService(serviceName))];
+    for (ClientId client: clients) {
+        /* Clients which already left the bus have no ID */
+        if (client != 0) activeAccount.addClient(client);
+    }
     if (!activeAccount.accountService) {
-        Accounts::Account *account = m_manager.account(accountId);
+        Accounts::Account *account = loadAccount(accountId);
         if (Q_UNLIKELY(!account)) return activeAccount;
 
-        Accounts::Service service = m_manager.service(serviceName);
+        HeapScope libaccountsScope(HeapAccounting::LibaccountsData);
+        Accounts::Service service = m_manager->service(serviceName);
         auto as = new Accounts::AccountService(account, service);
         activeAccount.accountService = as;
         QObject::connect(as, SIGNAL(enabled(bool)),
                          this, SLOT(onAccountServiceEnabled(bool)));
         QObject::connect(as, SIGNAL(changed()),
                          this, SLOT(onAccountServiceChanged()));
+        m_activeAccountsPeak = qMax(m_activeAccountsPeak,
+                                    m_activeAccounts.count());
+        m_stateSaver.scheduleSave();
     }
 
     return activeAccount;
 }
 
+void ManagerPrivate::removeClient(ClientId client)
+{
+    /* Give back what addClient() and addActiveAccount() charged */
+    HeapScope heapScope(HeapAccounting::ManagerData);
+
+    m_clients.remove(client);
+    m_stateSaver.scheduleSave();
+
+    for (auto i = m_pendingReplies.begin(); i != m_pendingReplies.end(); ) {
+        if (i->client.id == client) {
+            i = m_pendingReplies.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    /* Drop the client from all accounts, and release the AccountService
+     * objects which are no longer referenced by any client. */
+    for (auto i = m_activeAccounts.begin(); i != m_activeAccounts.end(); ) {
+        ActiveAccount &activeAccount = i.value();
+        activeAccount.removeClient(client);
+        if (activeAccount.clients.isEmpty()) {
+            {
+                HeapScope libaccountsScope(HeapAccounting::LibaccountsData);
+                delete activeAccount.accountService;
+            }
+            i = m_activeAccounts.erase(i);
+        } else {
+            i++;
+        }
+    }
+
+    /* If nobody is left, there's no point in monitoring the accounts for
+     * new services either; they'll be watched again when a client calls
+     * GetAccounts(). */
+    if (m_clients.isEmpty() && !ClientRegistry::instance()->hasClients()) {
+        Q_FOREACH(Accounts::Account *account, m_watchedAccounts) {
+            unwatchAccount(account);
+        }
+        m_watchingEnabledAccounts = false;
+    }
+
+    qDebug() << "Active accounts:" << m_activeAccounts.count() <<
+        "(peak" << m_activeAccountsPeak << ") watched accounts:" <<
+        m_watchedAccounts.count() << "(peak" << m_watchedAccountsPeak << ")";
+}
+
 AccountInfo ManagerPrivate::readAccountInfo(const Accounts::AccountService *as)
 {
     QVariantMap info;
@@ -354,7 +957,7 @@ ManagerPrivate::buildServiceList(const Accounts::Application &app) const
 {
     QList<QVariantMap> services;
 
-    const auto serviceList = m_manager.serviceList(app);
+    const auto serviceList = m_manager->serviceList(app);
     for (const Accounts::Service &service: serviceList) {
         QString displayName = translate(service.displayName(),
                                         service.trCatalog());
@@ -364,7 +967,7 @@ ManagerPrivate::buildServiceList(const Accounts::Application &app) const
          * (and account plugin) for that account is not installed. We probably
          * don't want to include these services in the list, as it would lead
          * to empty/invalid UI elements. */
-        Accounts::Provider provider = m_manager.provider(service.provider());
+        Accounts::Provider provider = m_manager->provider(service.provider());
         if (!provider.isValid()) continue;
 
         /* Now check the service data; if either display name or icon are
@@ -401,46 +1004,73 @@ QList<AccountInfo> ManagerPrivate::getAccounts(const QVariantMap &filters,
                                                const CallContext &context,
                                                QList<QVariantMap> &services)
 {
+    /* The reply lists are not charged to any subsystem: the daemon's own
+     * records are charged by addClient(), watchAccount() and
+     * addActiveAccount(). */
     QString desiredApplicationId = filters.value("applicationId").toString();
     QString desiredServiceId = filters.value("serviceId").toString();
     Accounts::AccountId desiredAccountId = filters.value("accountId").toUInt();
 
+    ClientInfo client = context.clientInfo();
     QString applicationId = desiredApplicationId.isEmpty() ?
-        applicationIdFromLabel(context.securityContext()) : desiredApplicationId;
+        client.applicationId : desiredApplicationId;
+
+    /* Replies only depend on the application and on the services the client
+     * can access; the client library only filters by application. */
+    QString replyKey;
+    if (filters.count() == filters.count("applicationId") &&
+        !client.securityContext.isEmpty()) {
+        replyKey = (client.unconfined ? QString('*') : client.packageId) +
+            '/' + applicationId;
+        if (m_loadStage != Loaded) validateReplies();
+        auto i = m_replies.constFind(replyKey);
+        bool isValid = i != m_replies.constEnd();
+        CallStatistics::instance()->addCacheLookup("accountsReplies", isValid);
+        if (isValid) {
+            services = i->services;
+            registerReply(client, context.clientName(), applicationId,
+                          i->accounts);
+            return i->accounts;
+        }
+    }
 
-    Accounts::Application application = m_manager.application(applicationId);
+    initialize();
+    Accounts::Application application = m_manager->application(applicationId);
 
     QList<AccountInfo> accounts;
 
-    if (!application.isValid() ||
-        !canAccess(context.securityContext(), applicationId)) {
+    if (!application.isValid() || !canActAs(client, applicationId)) {
         if (!desiredApplicationId.isEmpty()) {
             context.sendError(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED,
                               QString("App '%1' cannot act as '%2'").
                               arg(applicationId).arg(desiredApplicationId));
             return accounts;
         }
+        /* Not cached, since the same request with an explicit application
+         * ID would fail */
+        replyKey.clear();
     } else {
-        m_clients.insert(context.clientName(), application);
+        addClient(client, context.clientName(), application);
     }
 
     services = buildServiceList(application);
 
-    Q_FOREACH(Accounts::AccountId accountId, m_manager.accountListEnabled()) {
+    Q_FOREACH(Accounts::AccountId accountId, m_manager->accountListEnabled()) {
         if (desiredAccountId != 0 && accountId != desiredAccountId) {
             continue;
         }
 
-        Accounts::Account *account = m_manager.account(accountId);
+        Accounts::Account *account = loadAccount(accountId);
         if (Q_UNLIKELY(!account)) continue;
 
+        watchAccount(account);
         Q_FOREACH(Accounts::Service service, account->enabledServices()) {
             if (!desiredServiceId.isEmpty() &&
                 service.name() != desiredServiceId) {
                 continue;
             }
 
-            if (!canAccess(context.securityContext(), service.name())) {
+            if (!canAccess(client, service.name())) {
                 continue;
             }
 
@@ -451,11 +1081,22 @@ QList<AccountInfo> ManagerPrivate::getAccounts(const QVariantMap &filters,
             }
 
             ActiveAccount &activeAccount =
-                addActiveAccount(accountId, service.name(),
-                                 context.clientName());
+                addActiveAccount(accountId, service.name(), client.id);
             accounts.append(readAccountInfo(activeAccount.accountService));
         }
     }
+    if (desiredAccountId == 0) m_watchingEnabledAccounts = true;
+
+    if (!replyKey.isEmpty()) {
+        /* Computed once after each invalidation, for the snapshot */
+        if (m_repliesStamp.isEmpty()) {
+            m_repliesStamp = databaseStamp();
+        }
+        AccountsReply &reply = m_replies[replyKey];
+        reply.accounts = accounts;
+        reply.services = services;
+        m_stateSaver.scheduleSave();
+    }
 
     return accounts;
 }
@@ -465,14 +1106,16 @@ void ManagerPrivate::authenticate(uint accountId, const QString &serviceId,
                                   const QVariantMap &parameters,
                                   const CallContext &context)
 {
-    if (!canAccess(context.securityContext(), serviceId)) {
+    initialize();
+    ClientInfo client = context.clientInfo();
+    if (!canAccess(client, serviceId)) {
         context.sendError(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED,
                           QString("Access to service ID %1 forbidden").arg(serviceId));
         return;
     }
 
     ActiveAccount &activeAccount =
-        addActiveAccount(accountId, serviceId, context.clientName());
+        addActiveAccount(accountId, serviceId, client.id);
     auto as = activeAccount.accountService;
     if (!as || !as->isEnabled()) {
         context.sendError(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED,
@@ -480,13 +1123,16 @@ void ManagerPrivate::authenticate(uint accountId, const QString &serviceId,
         return;
     }
 
+    Accounts::AuthData authData = as->authData();
+    context.trace("authDataLoaded");
+
     AuthenticationRequest *authentication =
         new AuthenticationRequest(context, this);
     authentication->setInteractive(interactive);
     if (invalidate) {
         authentication->invalidateCache();
     }
-    authentication->authenticate(as->authData(), parameters);
+    authentication->authenticate(authData, parameters);
 }
 
 void ManagerPrivate::requestAccess(const QString &serviceId,
@@ -494,68 +1140,90 @@ void ManagerPrivate::requestAccess(const QString &serviceId,
                                    const CallContext &context)
 {
     Q_UNUSED(parameters);
-    if (!canAccess(context.securityContext(), serviceId)) {
+    initialize();
+    ClientInfo client = context.clientInfo();
+    if (!canAccess(client, serviceId)) {
         context.sendError(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED,
                           QString("Access to service ID %1 forbidden").arg(serviceId));
         return;
     }
 
+    QString applicationId = applicationIdFromServiceId(serviceId, client);
+    if (applicationId.isEmpty() && !client.unconfined &&
+        !applicationsForService(serviceId).isEmpty()) {
+        /* The service is used by applications, none of which belongs to the
+         * client's package: don't let it ask access on their behalf */
+        context.sendError(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED,
+                          QString("No application of package %1 uses "
+                                  "service ID %2").
+                          arg(client.packageId).arg(serviceId));
+        return;
+    }
+
     AccessRequest *accessRequest = new AccessRequest(context, this);
     QObject::connect(accessRequest, SIGNAL(loadRequest(uint, const QString&)),
                      this, SLOT(onLoadRequest(uint, const QString&)));
-    QString applicationId = applicationIdFromServiceId(serviceId);
     accessRequest->requestAccess(applicationId, serviceId, parameters,
-                                 context.clientPid());
+                                 client.pid);
 }
 
-bool ManagerPrivate::canAccess(const QString &context,
+bool ManagerPrivate::canAccess(const ClientInfo &client,
                                const QString &serviceId)
 {
     // Could not determine peer's AppArmor context, so deny access
-    if (context.isEmpty()) {
+    if (client.securityContext.isEmpty()) {
         return false;
     }
     // Unconfined processes can access anything
-    if (context == "unconfined") {
+    if (client.unconfined) {
         return true;
     }
-
-    // Try to extract the click package name from the AppArmor context.
-    int pos = context.indexOf('_');
-    if (pos < 0) {
-        qWarning() << "AppArmor context doesn't contain package ID: " << context;
+    // Confined apps without a package ID cannot access anything
+    if (client.packageId.isEmpty()) {
         return false;
     }
-    QString pkgname = context.left(pos);
 
-    // Do the same on the service ID: we are only dealing with
-    // confined apps at this point, so only $pkgname prefixed
-    // services are accessible.
-    pos = serviceId.indexOf('_');
-    if (pos < 0) {
-        return false;
-    }
-    return serviceId.left(pos) == pkgname;
+    return allowedServices(client.packageId).contains(serviceId);
 }
 
-QString ManagerPrivate::applicationIdFromLabel(const QString &label)
+bool ManagerPrivate::canActAs(const ClientInfo &client,
+                              const QString &applicationId)
 {
-    QStringList parts = label.split('_');
-    if (parts.count() == 3) {
-        return QStringList(parts.mid(0, 2)).join('_');
-    } else {
-        return QString();
+    if (client.securityContext.isEmpty()) return false;
+    if (client.unconfined) return true;
+    if (client.packageId.isEmpty()) return false;
+
+    // Confined apps can only act as applications from their own package
+    return applicationId.startsWith(client.packageId + '_');
+}
+
+const QSet<QString> &ManagerPrivate::allowedServices(const QString &packageId)
+{
+    auto i = m_allowedServices.find(packageId);
+    bool found = i != m_allowedServices.end();
+    CallStatistics::instance()->addCacheLookup("allowedServices", found);
+    if (i == m_allowedServices.end()) {
+        /* We are only dealing with confined apps at this point, so only
+         * $pkgname prefixed services are accessible. */
+        QString prefix = packageId + '_';
+        QSet<QString> services;
+        Q_FOREACH(const Accounts::Service &service, m_manager->serviceList()) {
+            if (service.name().startsWith(prefix)) {
+                services.insert(service.name());
+            }
+        }
+        i = m_allowedServices.insert(packageId, services);
     }
+    return i.value();
 }
 
 void ManagerPrivate::onAccountServiceEnabled(bool enabled)
 {
     auto as = qobject_cast<Accounts::AccountService*>(sender());
 
-    ActiveAccount &activeAccount =
-        m_activeAccounts[AccountCoordinates(as->account()->id(),
-                                            as->service().name())];
-    if (Q_UNLIKELY(!activeAccount.isValid())) return;
+    auto i = m_activeAccounts.constFind(coordinates(as));
+    if (Q_UNLIKELY(i == m_activeAccounts.constEnd() || !i->isValid())) return;
+    const ActiveAccount &activeAccount = i.value();
 
     notifyAccountChange(activeAccount,
                         enabled ? ONLINE_ACCOUNTS_INFO_CHANGE_ENABLED :
@@ -570,10 +1238,9 @@ void ManagerPrivate::onAccountServiceChanged()
         return;
     }
 
-    ActiveAccount &activeAccount =
-        m_activeAccounts[AccountCoordinates(as->account()->id(),
-                                            as->service().name())];
-    if (Q_UNLIKELY(!activeAccount.isValid())) return;
+    auto i = m_activeAccounts.constFind(coordinates(as));
+    if (Q_UNLIKELY(i == m_activeAccounts.constEnd() || !i->isValid())) return;
+    const ActiveAccount &activeAccount = i.value();
 
     notifyAccountChange(activeAccount, ONLINE_ACCOUNTS_INFO_CHANGE_UPDATED);
 }
@@ -586,12 +1253,14 @@ void ManagerPrivate::onAccountEnabled(const QString &serviceId, bool enabled)
         return;
     }
     auto account = qobject_cast<Accounts::Account*>(sender());
-    handleNewAccountService(account, m_manager.service(serviceId));
+    invalidateReplies();
+    handleNewAccountService(account, m_manager->service(serviceId));
 }
 
 void ManagerPrivate::onAccountCreated(Accounts::AccountId accountId)
 {
-    Accounts::Account *account = m_manager.account(accountId);
+    invalidateReplies();
+    Accounts::Account *account = loadAccount(accountId);
     if (Q_UNLIKELY(!account)) return;
     watchAccount(account);
     Q_FOREACH(Accounts::Service service, account->enabledServices()) {
@@ -599,15 +1268,36 @@ void ManagerPrivate::onAccountCreated(Accounts::AccountId accountId)
     }
 }
 
+void ManagerPrivate::onAccountRemoved(Accounts::AccountId accountId)
+{
+    invalidateReplies();
+    Q_FOREACH(Accounts::Account *account, m_watchedAccounts) {
+        if (account->id() == accountId) {
+            unwatchAccount(account);
+            break;
+        }
+    }
+}
+
+void ManagerPrivate::onClientUnregistered(uint clientId)
+{
+    ClientAccounting::instance()->removeClient(clientId);
+    CallStatistics::instance()->removeClient(clientId);
+    removeClient(clientId);
+}
+
 void ManagerPrivate::onLoadRequest(uint accountId, const QString &serviceId)
 {
     AccessRequest *request = qobject_cast<AccessRequest*>(sender());
 
+    ClientId clientId =
+        ClientRegistry::instance()->clientId(request->context().clientName());
     ActiveAccount &activeAccount =
-        addActiveAccount(accountId, serviceId,
-                         request->context().clientName());
+        addActiveAccount(accountId, serviceId, clientId);
     auto as = activeAccount.accountService;
-    request->setAccountInfo(readAccountInfo(as), as->authData());
+    Accounts::AuthData authData = as->authData();
+    request->context().trace("authDataLoaded");
+    request->setAccountInfo(readAccountInfo(as), authData);
 }
 
 Manager::Manager(QObject *parent):
@@ -627,6 +1317,57 @@ bool Manager::isIdle() const
     return d->m_isIdle;
 }
 
+uint Manager::activationCount() const
+{
+    Q_D(const Manager);
+    return d->m_activationStats.activations;
+}
+
+uint Manager::idleExitCount() const
+{
+    Q_D(const Manager);
+    return d->m_activationStats.idleExits;
+}
+
+qint64 Manager::msecsSinceIdleExit() const
+{
+    Q_D(const Manager);
+    return d->m_msecsSinceIdleExit;
+}
+
+QVariantMap Manager::statistics() const
+{
+    Q_D(const Manager);
+    return QVariantMap {
+        { "activeCalls", CallContextCounter::instance()->activeContexts() },
+        /* Only counts transitions between idle and busy */
+        { "callsIdleChanges", d->m_callsIdleChanges },
+        { "clients", d->m_clients.count() },
+        { "activeAccounts", d->m_activeAccounts.count() },
+        { "activeAccountsPeak", d->m_activeAccountsPeak },
+        { "watchedAccounts", d->m_watchedAccounts.count() },
+        { "watchedAccountsPeak", d->m_watchedAccountsPeak },
+        { "cachedReplies", d->m_replies.count() },
+        { "activations", d->m_activationStats.activations },
+        { "idleExits", d->m_activationStats.idleExits },
+        /* Scheduled saves, including those not rewriting the file */
+        { "stateSaves", d->m_stateSaves },
+    };
+}
+
+void Manager::setInactivityTimeout(int timeout)
+{
+    Q_D(Manager);
+    d->m_activationStats.inactivityTimeout = timeout;
+    d->m_stateSaver.setActivationStats(d->m_activationStats);
+}
+
+int Manager::inactivityTimeout() const
+{
+    Q_D(const Manager);
+    return d->m_activationStats.inactivityTimeout;
+}
+
 QList<AccountInfo> Manager::getAccounts(const QVariantMap &filters,
                                         const CallContext &context,
                                         QList<QVariantMap> &services)
@@ -659,6 +1400,27 @@ void Manager::onDisconnected()
     QCoreApplication::instance()->quit();
 }
 
+void Manager::markStartupPhase(const QString &phase, qint64 timestamp)
+{
+    StartupTimings::instance()->mark(phase, timestamp);
+}
+
+void Manager::writeTrace()
+{
+    QString fileName = Tracer::instance()->writeChromeTrace();
+    if (!fileName.isEmpty()) {
+        qDebug() << "Trace written to" << fileName;
+    }
+}
+
+void Manager::onInactivityTimeout()
+{
+    Q_D(Manager);
+    d->m_activationStats.idleExits++;
+    d->m_activationStats.lastIdleExit = QDateTime::currentMSecsSinceEpoch();
+    d->m_stateSaver.setActivationStats(d->m_activationStats);
+}
+
 void *oad_create_manager(QObject *parent)
 {
     return new Manager(parent);
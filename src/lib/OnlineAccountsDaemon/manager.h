@@ -44,6 +44,11 @@ class Manager: public QObject, protected QDBusContext
 {
     Q_OBJECT
     Q_PROPERTY(bool isIdle READ isIdle NOTIFY isIdleChanged)
+    Q_PROPERTY(uint activationCount READ activationCount CONSTANT)
+    Q_PROPERTY(uint idleExitCount READ idleExitCount)
+    Q_PROPERTY(qint64 msecsSinceIdleExit READ msecsSinceIdleExit CONSTANT)
+    Q_PROPERTY(int inactivityTimeout READ inactivityTimeout
+               WRITE setInactivityTimeout)
 
 public:
     explicit Manager(QObject *parent = 0);
@@ -51,6 +56,15 @@ public:
 
     bool isIdle() const;
 
+    uint activationCount() const;
+    uint idleExitCount() const;
+    qint64 msecsSinceIdleExit() const;
+
+    void setInactivityTimeout(int timeout);
+    int inactivityTimeout() const;
+
+    QVariantMap statistics() const;
+
     QList<AccountInfo> getAccounts(const QVariantMap &filters,
                                    const CallContext &context,
                                    QList<QVariantMap> &services);
@@ -64,6 +78,9 @@ public:
 
 public Q_SLOTS:
     void onDisconnected();
+    void onInactivityTimeout();
+    void markStartupPhase(const QString &phase, qint64 timestamp);
+    void writeTrace();
 
 Q_SIGNALS:
     void isIdleChanged();
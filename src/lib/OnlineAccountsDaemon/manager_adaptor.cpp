@@ -20,12 +20,30 @@
 
 #include "manager_adaptor.h"
 
+#include <QDBusConnection>
+#include <QDBusMessage>
 #include <QDBusMetaType>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QSharedData>
+#include "call_recorder.h"
+#include "call_statistics.h"
+#include "client_accounting.h"
 #include "client_registry.h"
+#include "dbus_constants.h"
+#include "startup_timings.h"
+#include "tracer.h"
 
 using namespace OnlineAccountsDaemon;
 
+namespace {
+
+/* Set once the "firstReply" startup phase has been marked, to avoid looking
+ * it up again on every reply */
+bool firstReplySent = false;
+
+} // namespace
+
 QDBusArgument &operator<<(QDBusArgument &argument, const AccountInfo &info)
 {
     argument.beginStructure();
@@ -43,56 +61,187 @@ const QDBusArgument &operator>>(const QDBusArgument &argument,
     return argument;
 }
 
-CallContext::CallContext(QDBusContext *dbusContext):
+namespace OnlineAccountsDaemon {
+
+class CallContextData: public QSharedData
+{
+public:
+    CallContextData(QDBusContext *dbusContext);
+    ~CallContextData();
+
+private:
+    friend class CallContext;
+    QDBusConnection m_connection;
+    QDBusMessage m_message;
+    QElapsedTimer m_timer;
+    quint32 m_traceId;
+    /* Set by admit(), if client accounting is enabled */
+    uint m_clientId;
+    uint m_accountedClient;
+    bool m_isFinished;
+};
+
+} // namespace
+
+CallContextData::CallContextData(QDBusContext *dbusContext):
     m_connection(dbusContext->connection()),
-    m_message(dbusContext->message())
+    m_message(dbusContext->message()),
+    m_traceId(Tracer::instance()->newTraceId()),
+    m_clientId(0),
+    m_accountedClient(0),
+    m_isFinished(false)
+{
+    m_timer.start();
+    Tracer::instance()->addEvent(m_traceId, "received", m_message.member());
+    CallContextCounter::instance()->addContext();
+}
+
+CallContextData::~CallContextData()
+{
+    /* The call was dropped without a reply */
+    if (m_accountedClient != 0) {
+        ClientAccounting::instance()->callFinished(m_accountedClient);
+    }
+    CallContextCounter::instance()->removeContext();
+}
+
+CallContext::CallContext(QDBusContext *dbusContext):
+    d(new CallContextData(dbusContext))
 {
-    CallContextCounter::instance()->addContext(*this);
 }
 
 CallContext::CallContext(const CallContext &other):
-    m_connection(other.m_connection),
-    m_message(other.m_message)
+    d(other.d)
+{
+}
+
+CallContext::CallContext(CallContext &&other):
+    d(std::move(other.d))
 {
-    CallContextCounter::instance()->addContext(*this);
 }
 
 CallContext::~CallContext()
 {
-    CallContextCounter::instance()->removeContext(*this);
+}
+
+CallContext &CallContext::operator=(const CallContext &other)
+{
+    d = other.d;
+    return *this;
+}
+
+CallContext &CallContext::operator=(CallContext &&other)
+{
+    d.swap(other.d);
+    return *this;
 }
 
 void CallContext::setDelayedReply(bool delayed)
 {
-    m_message.setDelayedReply(delayed);
+    d->m_message.setDelayedReply(delayed);
 }
 
 void CallContext::sendReply(const QList<QVariant> &args) const
 {
-    m_connection.send(m_message.createReply(args));
+    d->m_connection.send(d->m_message.createReply(args));
+    callFinished();
 }
 
 void CallContext::sendError(const QString &name, const QString &message) const
 {
-    m_connection.send(m_message.createErrorReply(name, message));
+    d->m_connection.send(d->m_message.createErrorReply(name, message));
+    callFinished(name);
 }
 
-QString CallContext::securityContext() const
+void CallContext::notifyAutomaticReply() const
+{
+    if (!d->m_isFinished) callFinished();
+}
+
+bool CallContext::admit(ReplyMode replyMode) const
+{
+    bool isDelayed = (replyMode == DelayedReply);
+    ClientAccounting *accounting = ClientAccounting::instance();
+    if (!accounting->isEnabled()) return true;
+
+    ClientInfo client = clientInfo();
+    QString reason;
+    if (!accounting->admitCall(client.id, clientName(), client.securityContext,
+                               isDelayed, &reason)) {
+        /* Don't let QtDBus send a reply of its own */
+        d->m_message.setDelayedReply(true);
+        sendError(ONLINE_ACCOUNTS_ERROR_THROTTLED, reason);
+        return false;
+    }
+    d->m_clientId = client.id;
+    if (isDelayed) d->m_accountedClient = client.id;
+    return true;
+}
+
+void CallContext::callFinished(const QString &errorName) const
+{
+    d->m_isFinished = true;
+    if (d->m_accountedClient != 0) {
+        ClientAccounting::instance()->callFinished(d->m_accountedClient);
+        d->m_accountedClient = 0;
+    }
+    trace("replySent");
+    if (Q_UNLIKELY(!firstReplySent)) {
+        StartupTimings::instance()->mark("firstReply");
+        firstReplySent = true;
+    }
+    CallStatistics *statistics = CallStatistics::instance();
+    if (statistics->isEnabled()) {
+        statistics->addCall(d->m_message.member(), clientId(),
+                            d->m_message.service(),
+                            d->m_timer.nsecsElapsed(), errorName);
+    }
+}
+
+quint32 CallContext::traceId() const
+{
+    return d->m_traceId;
+}
+
+void CallContext::trace(const char *event) const
+{
+    Tracer::instance()->addEvent(d->m_traceId, event);
+}
+
+ClientInfo CallContext::clientInfo() const
 {
     ClientRegistry *clientRegistry = ClientRegistry::instance();
-    QString client = clientRegistry->registerClient(m_connection, m_message);
-    return clientRegistry->clientSecurityContext(client);
+    QString client =
+        clientRegistry->registerClient(d->m_connection, d->m_message);
+    ClientInfo info = clientRegistry->clientInfo(client);
+    trace("securityContextResolved");
+    return info;
+}
+
+uint CallContext::accountedClientId() const
+{
+    return d->m_clientId;
+}
+
+uint CallContext::clientId() const
+{
+    return ClientRegistry::instance()->clientId(d->m_message.service());
+}
+
+QString CallContext::securityContext() const
+{
+    return clientInfo().securityContext;
 }
 
 pid_t CallContext::clientPid() const
 {
     ClientRegistry *clientRegistry = ClientRegistry::instance();
-    return clientRegistry->clientPid(m_message.service());
+    return clientRegistry->clientPid(d->m_message.service());
 }
 
 QString CallContext::clientName() const
 {
-    return m_message.service();
+    return d->m_message.service();
 }
 
 static CallContextCounter *m_callContextCounterInstance = 0;
@@ -111,16 +260,18 @@ CallContextCounter *CallContextCounter::instance()
     return m_callContextCounterInstance;
 }
 
-void CallContextCounter::addContext(const CallContext &)
+void CallContextCounter::addContext()
 {
-    m_contexts++;
-    Q_EMIT activeContextsChanged();
+    if (m_contexts++ == 0) {
+        Q_EMIT isIdleChanged();
+    }
 }
 
-void CallContextCounter::removeContext(const CallContext &)
+void CallContextCounter::removeContext()
 {
-    m_contexts--;
-    Q_EMIT activeContextsChanged();
+    if (--m_contexts == 0) {
+        Q_EMIT isIdleChanged();
+    }
 }
 
 namespace OnlineAccountsDaemon {
@@ -170,9 +321,16 @@ QVariantMap ManagerAdaptor::Authenticate(uint accountId,
                                          bool interactive, bool invalidate,
                                          const QVariantMap &parameters)
 {
+    CallContext context(dbusContext());
+    CallRecorder::instance()->recordAuthenticate(context, accountId, serviceId,
+                                                 interactive, invalidate,
+                                                 parameters);
+    if (!context.admit(CallContext::DelayedReply)) return QVariantMap();
+
+    ClientCpuScope cpuScope(context.accountedClientId());
     parent()->authenticate(accountId, serviceId,
                            interactive, invalidate, parameters,
-                           CallContext(dbusContext()));
+                           context);
     return QVariantMap();
 }
 
@@ -180,17 +338,27 @@ void ManagerAdaptor::GetAccounts(const QVariantMap &filters,
                                  QList<AccountInfo> &accounts,
                                  QList<QVariantMap> &services)
 {
-    accounts = parent()->getAccounts(filters,
-                                     CallContext(dbusContext()),
-                                     services);
+    CallContext context(dbusContext());
+    CallRecorder::instance()->recordGetAccounts(context, filters);
+    if (!context.admit(CallContext::ImmediateReply)) return;
+
+    ClientCpuScope cpuScope(context.accountedClientId());
+    accounts = parent()->getAccounts(filters, context, services);
+    /* The reply is sent as soon as we return */
+    context.notifyAutomaticReply();
 }
 
 AccountInfo ManagerAdaptor::RequestAccess(const QString &serviceId,
                                           const QVariantMap &parameters,
                                           QVariantMap &credentials)
 {
-    parent()->requestAccess(serviceId, parameters,
-                            CallContext(dbusContext()));
+    CallContext context(dbusContext());
+    CallRecorder::instance()->recordRequestAccess(context, serviceId,
+                                                  parameters);
+    if (!context.admit(CallContext::DelayedReply)) return AccountInfo();
+
+    ClientCpuScope cpuScope(context.accountedClientId());
+    parent()->requestAccess(serviceId, parameters, context);
     credentials = QVariantMap();
     return AccountInfo();
 }
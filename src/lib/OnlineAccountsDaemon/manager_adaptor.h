@@ -22,9 +22,8 @@
 #define ONLINE_ACCOUNTS_DAEMON_MANAGER_ADAPTOR_H
 
 #include <QDBusAbstractAdaptor>
-#include <QDBusConnection>
 #include <QDBusContext>
-#include <QDBusMessage>
+#include <QExplicitlySharedDataPointer>
 #include <QString>
 #include <QVariantMap>
 #include <sys/types.h>
@@ -33,23 +32,53 @@
 
 namespace OnlineAccountsDaemon {
 
+struct ClientInfo;
+
+/* Copies of a CallContext refer to the same call: they are cheap, and the
+ * call is accounted as active until the last of them is gone. */
+class CallContextData;
 class CallContext {
 public:
+    enum ReplyMode {
+        /* The reply is sent before the handler returns */
+        ImmediateReply = 0,
+        /* The reply is sent later, possibly after a signond session */
+        DelayedReply,
+    };
+
     explicit CallContext(QDBusContext *dbusContext);
     CallContext(const CallContext &other);
+    CallContext(CallContext &&other);
     virtual ~CallContext();
 
+    CallContext &operator=(const CallContext &other);
+    CallContext &operator=(CallContext &&other);
+
     void setDelayedReply(bool delayed);
     void sendReply(const QList<QVariant> &args) const;
     void sendError(const QString &name, const QString &message) const;
-
+    /* To be called when QtDBus sends the reply for us */
+    void notifyAutomaticReply() const;
+    /* Checks the client's quotas: if they are exceeded, replies with an
+     * error and returns false. */
+    bool admit(ReplyMode replyMode) const;
+
+    quint32 traceId() const;
+    void trace(const char *event) const;
+
+    ClientInfo clientInfo() const;
+    uint clientId() const;
+    /* The client charged for the call; 0 if client accounting is off */
+    uint accountedClientId() const;
     QString securityContext() const;
     pid_t clientPid() const;
     QString clientName() const;
 
 private:
-    QDBusConnection m_connection;
-    QDBusMessage m_message;
+    void callFinished(const QString &errorName = QString()) const;
+
+private:
+    QExplicitlySharedDataPointer<CallContextData> d;
 };
 
 class CallContextCounter: public QObject
@@ -60,16 +89,18 @@ public:
     static CallContextCounter *instance();
 
     int activeContexts() const { return m_contexts; }
+    bool isIdle() const { return m_contexts == 0; }
 
 Q_SIGNALS:
-    void activeContextsChanged();
+    /* Only emitted when going from idle to busy and vice versa */
+    void isIdleChanged();
 
 protected:
-    void addContext(const CallContext &context);
-    void removeContext(const CallContext &context);
+    void addContext();
+    void removeContext();
 
 private:
-    friend class CallContext;
+    friend class CallContextData;
     CallContextCounter();
 
     int m_contexts;
@@ -0,0 +1,98 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "startup_timings.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QFile>
+#include <time.h>
+#include <unistd.h>
+#include "global.h"
+
+using namespace OnlineAccountsDaemon;
+
+namespace {
+
+qint64 readProcessStartTime()
+{
+    /* The 22nd field of /proc/self/stat is the start time of the process,
+     * in clock ticks since boot; the 2nd field (the command name) can
+     * contain spaces, so start counting after it. */
+    QFile file("/proc/self/stat");
+    if (Q_UNLIKELY(!file.open(QIODevice::ReadOnly))) return 0;
+
+    QByteArray stat = file.readAll();
+    int commandEnd = stat.lastIndexOf(')');
+    if (Q_UNLIKELY(commandEnd < 0)) return 0;
+
+    QList<QByteArray> fields = stat.mid(commandEnd + 2).split(' ');
+    if (Q_UNLIKELY(fields.count() < 20)) return 0;
+
+    qint64 ticks = fields[19].toLongLong();
+    return ticks * Q_INT64_C(1000000000) / sysconf(_SC_CLK_TCK);
+}
+
+} // namespace
+
+static StartupTimings *m_startupTimingsInstance = 0;
+
+StartupTimings::StartupTimings():
+    m_processStartTime(readProcessStartTime())
+{
+    if (m_processStartTime == 0) {
+        /* Better than nothing */
+        m_processStartTime = now();
+    }
+}
+
+StartupTimings *StartupTimings::instance()
+{
+    if (!m_startupTimingsInstance) {
+        m_startupTimingsInstance = new StartupTimings;
+    }
+    return m_startupTimingsInstance;
+}
+
+qint64 StartupTimings::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return qint64(ts.tv_sec) * Q_INT64_C(1000000000) + ts.tv_nsec;
+}
+
+void StartupTimings::mark(const QString &phase, qint64 timestamp)
+{
+    /* Only the first occurrence of a phase is part of the startup */
+    if (isMarked(phase)) return;
+
+    qint64 elapsed = timestamp - m_processStartTime;
+    m_phases.append(StartupPhase(phase, elapsed));
+    qCDebug(DBG_ONLINE_ACCOUNTS_DAEMON) << "Startup phase" << phase <<
+        "reached after" << elapsed / 1000 << "us";
+}
+
+bool StartupTimings::isMarked(const QString &phase) const
+{
+    Q_FOREACH(const StartupPhase &startupPhase, m_phases) {
+        if (startupPhase.first == phase) return true;
+    }
+    return false;
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_STARTUP_TIMINGS_H
+#define ONLINE_ACCOUNTS_DAEMON_STARTUP_TIMINGS_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include "global.h"
+
+namespace OnlineAccountsDaemon {
+
+/* Phase name, and its time in nanoseconds since the process started */
+typedef QPair<QString,qint64> StartupPhase;
+
+class OAD_EXPORT StartupTimings
+{
+public:
+    static StartupTimings *instance();
+
+    /* Monotonic time (including suspend), in nanoseconds */
+    static qint64 now();
+
+    void mark(const QString &phase, qint64 timestamp = now());
+    bool isMarked(const QString &phase) const;
+    QList<StartupPhase> phases() const { return m_phases; }
+
+private:
+    StartupTimings();
+
+    qint64 m_processStartTime;
+    QList<StartupPhase> m_phases;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_STARTUP_TIMINGS_H
@@ -20,49 +20,122 @@
 
 #include "state_saver.h"
 
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDataStream>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
-#include <QJsonValue>
+#include <QSaveFile>
 #include <QStandardPaths>
+#include <QTimer>
+#include "heap_accounting.h"
 
 using namespace OnlineAccountsDaemon;
 
+namespace {
+
+/* File header: magic number and format version */
+const quint32 stateFileMagic = 0x4f414453; // "OADS"
+const quint32 stateFileVersion = 1;
+
+/* State file written by older versions of the daemon */
+const char legacyStateFile[] = "client_account_refs.json";
+
+/* How long to wait for further changes before writing the state */
+const int saveDelay = 1000;
+
+} // namespace
+
 namespace OnlineAccountsDaemon {
 
-class StateSaverPrivate {
+QDataStream &operator<<(QDataStream &stream, const AccountInfo &account)
+{
+    return stream << quint32(account.accountId) << account.details;
+}
+
+QDataStream &operator>>(QDataStream &stream, AccountInfo &account)
+{
+    quint32 accountId;
+    stream >> accountId >> account.details;
+    account.accountId = accountId;
+    return stream;
+}
+
+QDataStream &operator<<(QDataStream &stream, const AccountsReply &reply)
+{
+    return stream << reply.accounts << reply.services;
+}
+
+QDataStream &operator>>(QDataStream &stream, AccountsReply &reply)
+{
+    return stream >> reply.accounts >> reply.services;
+}
+
+QDataStream &operator<<(QDataStream &stream, const ActivationStats &stats)
+{
+    return stream << stats.activations << stats.idleExits <<
+        stats.lastIdleExit << stats.inactivityTimeout;
+}
+
+QDataStream &operator>>(QDataStream &stream, ActivationStats &stats)
+{
+    return stream >> stats.activations >> stats.idleExits >>
+        stats.lastIdleExit >> stats.inactivityTimeout;
+}
+
+class StateSaverPrivate: public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PUBLIC(StateSaver)
+
 public:
-    StateSaverPrivate();
+    StateSaverPrivate(StateSaver *q);
     ~StateSaverPrivate();
 
-    static QList<AccountInfo> accountsFromJson(const QJsonValue &value);
-    static QJsonValue accountsToJson(const QList<AccountInfo> &accounts);
-
-    static QList<Client> clientsFromJson(const QJsonValue &value);
-    static QJsonValue clientsToJson(const QList<Client> &clients);
+    QByteArray serialize() const;
+    bool deserialize(const QByteArray &data);
 
+    bool loadLegacy();
     void load();
     void save();
 
+private Q_SLOTS:
+    void onSaveTimeout();
+
 private:
-    friend class StateSaver;
     QString m_cacheFile;
+    QString m_legacyCacheFile;
     QList<Client> m_clients;
     QList<AccountInfo> m_accounts;
+    QByteArray m_repliesStamp;
+    AccountsReplies m_replies;
+    ActivationStats m_activationStats;
+    QByteArray m_savedDataHash;
+    QTimer m_saveTimer;
+    StateSaver *q_ptr;
 };
 
 } // namespace
 
-StateSaverPrivate::StateSaverPrivate()
+StateSaverPrivate::StateSaverPrivate(StateSaver *q):
+    QObject(q),
+    q_ptr(q)
 {
     QDir cacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
     if (!cacheDir.exists()) {
         cacheDir.mkpath(".");
     }
-    m_cacheFile = cacheDir.filePath("client_account_refs.json");
+    m_cacheFile = cacheDir.filePath("client_account_refs.bin");
+    m_legacyCacheFile = cacheDir.filePath(legacyStateFile);
+
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(saveDelay);
+    QObject::connect(&m_saveTimer, SIGNAL(timeout()),
+                     this, SLOT(onSaveTimeout()));
 
     load();
 }
@@ -72,89 +145,155 @@ StateSaverPrivate::~StateSaverPrivate()
     save();
 }
 
-QList<AccountInfo>
-StateSaverPrivate::accountsFromJson(const QJsonValue &value)
+QByteArray StateSaverPrivate::serialize() const
 {
-    QList<AccountInfo> accounts;
-    QJsonArray jsonAccounts = value.toArray();
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << stateFileMagic << stateFileVersion;
+    stream.setVersion(QDataStream::Qt_5_4);
 
-    Q_FOREACH(const QJsonValue &jsonAccount, jsonAccounts) {
-        QJsonObject jsonObject = jsonAccount.toObject();
-        int accountId = jsonObject.value("accountId").toInt();
-        QVariantMap details =
-            jsonObject.value("details").toObject().toVariantMap();
-        accounts.append(AccountInfo(uint(accountId), details));
-    }
-    return accounts;
+    stream << m_clients << m_accounts;
+    stream << m_repliesStamp << m_replies;
+    stream << m_activationStats;
+    return data;
 }
 
-QJsonValue
-StateSaverPrivate::accountsToJson(const QList<AccountInfo> &accounts)
+bool StateSaverPrivate::deserialize(const QByteArray &data)
 {
-    Q_UNUSED(accounts);
-    return QJsonValue(); // TODO
-}
+    QDataStream stream(data);
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != stateFileMagic || version != stateFileVersion) {
+        qWarning() << "Ignoring state file with unknown format" << version;
+        return false;
+    }
+    stream.setVersion(QDataStream::Qt_5_4);
 
-QList<Client> StateSaverPrivate::clientsFromJson(const QJsonValue &value)
-{
     QList<Client> clients;
-    Q_FOREACH(const QJsonValue &jsonClient, value.toArray()) {
-        QJsonObject jsonObject = jsonClient.toObject();
-        QString busName = jsonObject.value("busName").toString();
-        QString applicationId = jsonObject.value("applicationId").toString();
-        clients.append(Client(busName, applicationId));
-    }
-    return clients;
-}
+    QList<AccountInfo> accounts;
+    QByteArray repliesStamp;
+    AccountsReplies replies;
+    ActivationStats activationStats;
+    stream >> clients >> accounts;
+    stream >> repliesStamp >> replies;
+    stream >> activationStats;
 
-QJsonValue StateSaverPrivate::clientsToJson(const QList<Client> &clients)
-{
-    QJsonArray clientArray;
-    Q_FOREACH(const Client &client, clients) {
-        QJsonObject clientObject;
-        clientObject.insert("busName", client.first);
-        clientObject.insert("applicationId", client.second);
-        clientArray.append(clientObject);
+    if (Q_UNLIKELY(stream.status() != QDataStream::Ok)) {
+        qWarning() << "State file" << m_cacheFile << "is corrupted";
+        return false;
     }
-    return QJsonValue(clientArray);
+
+    m_clients = clients;
+    m_accounts = accounts;
+    m_repliesStamp = repliesStamp;
+    m_replies = replies;
+    m_activationStats = activationStats;
+    return true;
 }
 
 void StateSaverPrivate::save()
 {
-    QFile file(m_cacheFile);
-    if (Q_UNLIKELY(!file.open(QIODevice::WriteOnly | QIODevice::Text))) {
+    m_saveTimer.stop();
+
+    QByteArray data = serialize();
+    QByteArray dataHash = QCryptographicHash::hash(data, QCryptographicHash::Md5);
+    if (dataHash == m_savedDataHash) return; // nothing changed
+
+    /* Write to a temporary file and rename it, so that the state file is
+     * never left half-written */
+    QSaveFile file(m_cacheFile);
+    if (Q_UNLIKELY(!file.open(QIODevice::WriteOnly))) {
         qWarning() << "Couldn't save state to" << m_cacheFile;
         return;
     }
 
-    QJsonObject jsonObject;
-    jsonObject.insert("accounts", accountsToJson(m_accounts));
-    jsonObject.insert("clients", clientsToJson(m_clients));
+    file.write(data);
+    if (Q_UNLIKELY(!file.commit())) {
+        qWarning() << "Couldn't save state to" << m_cacheFile <<
+            file.errorString();
+        return;
+    }
+    m_savedDataHash = dataHash;
+}
 
-    QJsonDocument doc(jsonObject);
-    file.write(doc.toJson());
+bool StateSaverPrivate::loadLegacy()
+{
+    QFile file(m_legacyCacheFile);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return false;
+
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    if (doc.isEmpty() || !doc.isObject()) return false;
+
+    QJsonObject jsonObject = doc.object();
+    Q_FOREACH(const QJsonValue &jsonAccount,
+              jsonObject.value("accounts").toArray()) {
+        QJsonObject accountObject = jsonAccount.toObject();
+        int accountId = accountObject.value("accountId").toInt();
+        QVariantMap details =
+            accountObject.value("details").toObject().toVariantMap();
+        m_accounts.append(AccountInfo(uint(accountId), details));
+    }
+    Q_FOREACH(const QJsonValue &jsonClient,
+              jsonObject.value("clients").toArray()) {
+        QJsonObject clientObject = jsonClient.toObject();
+        QString busName = clientObject.value("busName").toString();
+        QString applicationId =
+            clientObject.value("applicationId").toString();
+        m_clients.append(Client(busName, applicationId));
+    }
+    return true;
 }
 
 void StateSaverPrivate::load()
 {
+    HeapScope heapScope(HeapAccounting::StateSaverData);
+
+    /* The state written by older versions of the daemon is converted once,
+     * and then removed */
+    if (QFile::exists(m_legacyCacheFile)) {
+        bool migrated = !QFile::exists(m_cacheFile) && loadLegacy();
+        if (migrated) save();
+        QFile::remove(m_legacyCacheFile);
+        if (migrated) return;
+    }
+
     QFile file(m_cacheFile);
-    if (Q_UNLIKELY(!file.open(QIODevice::ReadOnly | QIODevice::Text))) {
+    if (Q_UNLIKELY(!file.open(QIODevice::ReadOnly))) {
         qWarning() << "Cannot open file" << m_cacheFile;
         return;
     }
 
-    QByteArray contents = file.readAll();
-    QJsonDocument doc = QJsonDocument::fromJson(contents);
-    if (doc.isEmpty() || !doc.isObject()) return;
+    qint64 size = file.size();
+    if (size == 0) return;
 
-    QJsonObject jsonObject = doc.object();
-    m_accounts = accountsFromJson(jsonObject.value("accounts"));
-    m_clients = clientsFromJson(jsonObject.value("clients"));
+    uchar *mapped = file.map(0, size);
+    if (Q_UNLIKELY(!mapped)) {
+        qWarning() << "Cannot map file" << m_cacheFile;
+        return;
+    }
+
+    /* No copy of the file contents is made: the parsed data is detached
+     * from the mapped memory before unmapping it */
+    QByteArray data =
+        QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    if (deserialize(data)) {
+        m_savedDataHash = QCryptographicHash::hash(data,
+                                                   QCryptographicHash::Md5);
+    }
+    file.unmap(mapped);
+}
+
+void StateSaverPrivate::onSaveTimeout()
+{
+    Q_Q(StateSaver);
+    /* Give the owner a chance to provide the latest state */
+    Q_EMIT q->aboutToSave();
+    save();
 }
 
 StateSaver::StateSaver(QObject *parent):
     QObject(parent),
-    d_ptr(new StateSaverPrivate)
+    d_ptr(new StateSaverPrivate(this))
 {
 }
 
@@ -186,3 +325,46 @@ QList<Client> StateSaver::clients() const
     Q_D(const StateSaver);
     return d->m_clients;
 }
+
+void StateSaver::setAccountsReplies(const QByteArray &stamp,
+                                    const AccountsReplies &replies)
+{
+    Q_D(StateSaver);
+    d->m_repliesStamp = stamp;
+    d->m_replies = replies;
+}
+
+QByteArray StateSaver::accountsRepliesStamp() const
+{
+    Q_D(const StateSaver);
+    return d->m_repliesStamp;
+}
+
+AccountsReplies StateSaver::accountsReplies() const
+{
+    Q_D(const StateSaver);
+    return d->m_replies;
+}
+
+void StateSaver::setActivationStats(const ActivationStats &stats)
+{
+    Q_D(StateSaver);
+    d->m_activationStats = stats;
+}
+
+ActivationStats StateSaver::activationStats() const
+{
+    Q_D(const StateSaver);
+    return d->m_activationStats;
+}
+
+void StateSaver::scheduleSave()
+{
+    Q_D(StateSaver);
+    /* Coalesce all the changes happening within the save delay */
+    if (!d->m_saveTimer.isActive()) {
+        d->m_saveTimer.start();
+    }
+}
+
+#include "state_saver.moc"
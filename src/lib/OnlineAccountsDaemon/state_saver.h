@@ -21,6 +21,7 @@
 #ifndef ONLINE_ACCOUNTS_DAEMON_STATE_SAVER_H
 #define ONLINE_ACCOUNTS_DAEMON_STATE_SAVER_H
 
+#include <QHash>
 #include <QObject>
 #include <QStringList>
 #include "account_info.h"
@@ -29,6 +30,26 @@ namespace OnlineAccountsDaemon {
 
 typedef QPair<QString,QString> Client;
 
+/* Result of a GetAccounts() call, as it was sent to a client */
+struct AccountsReply {
+    QList<AccountInfo> accounts;
+    QList<QVariantMap> services;
+};
+typedef QHash<QString,AccountsReply> AccountsReplies;
+
+/* Activation history of the daemon, used to tune its inactivity timeout */
+struct ActivationStats {
+    ActivationStats():
+        activations(0), idleExits(0), lastIdleExit(0), inactivityTimeout(0) {}
+
+    quint32 activations;
+    quint32 idleExits;
+    /* Time of the last exit, in ms since the epoch, if the last run ended
+     * because of inactivity; 0 otherwise */
+    qint64 lastIdleExit;
+    qint32 inactivityTimeout;
+};
+
 class StateSaverPrivate;
 class StateSaver: public QObject
 {
@@ -44,6 +65,19 @@ public:
     void setClients(const QList<Client> &clients);
     QList<Client> clients() const;
 
+    void setAccountsReplies(const QByteArray &stamp,
+                            const AccountsReplies &replies);
+    QByteArray accountsRepliesStamp() const;
+    AccountsReplies accountsReplies() const;
+
+    void setActivationStats(const ActivationStats &stats);
+    ActivationStats activationStats() const;
+
+    void scheduleSave();
+
+Q_SIGNALS:
+    void aboutToSave();
+
 private:
     Q_DECLARE_PRIVATE(StateSaver)
     StateSaverPrivate *d_ptr;
@@ -0,0 +1,144 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+using namespace OnlineAccountsDaemon;
+
+namespace {
+
+/* About 150 calls, with the events of Authenticate() */
+const int maxEvents = 1024;
+
+} // namespace
+
+static Tracer *m_tracerInstance = 0;
+
+Tracer::Tracer():
+    m_events(maxEvents),
+    m_nextEvent(0),
+    m_lastTraceId(0)
+{
+    m_clock.start();
+}
+
+Tracer *Tracer::instance()
+{
+    if (!m_tracerInstance) {
+        m_tracerInstance = new Tracer;
+    }
+    return m_tracerInstance;
+}
+
+void Tracer::addEvent(quint32 traceId, const char *name,
+                      const QString &detail)
+{
+    Event &event = m_events[m_nextEvent];
+    event.traceId = traceId;
+    event.name = name;
+    event.timestamp = m_clock.nsecsElapsed();
+    event.detail = detail;
+    m_nextEvent = (m_nextEvent + 1) % maxEvents;
+}
+
+QByteArray Tracer::toChromeTrace() const
+{
+    /* Each call is shown as its own thread; each event becomes a complete
+     * ("X") event lasting from the previous event of the same call, so that
+     * the time spent between any two steps is visible. */
+    qint64 pid = QCoreApplication::applicationPid();
+    QHash<quint32,qint64> lastTimestamps;
+    QHash<quint32,QString> methods;
+    QJsonArray traceEvents;
+
+    for (int n = 0; n < maxEvents; n++) {
+        const Event &event = m_events[(m_nextEvent + n) % maxEvents];
+        if (!event.name) continue;
+
+        qint64 usecs = event.timestamp / 1000;
+        auto last = lastTimestamps.find(event.traceId);
+        if (last == lastTimestamps.end()) {
+            /* The first event we have for this call: it might have been
+             * partly overwritten, but we can still show the rest of it */
+            last = lastTimestamps.insert(event.traceId, usecs);
+        }
+        if (!event.detail.isEmpty()) {
+            methods.insert(event.traceId, event.detail);
+        }
+
+        QJsonObject args {
+            { "traceId", qint64(event.traceId) },
+        };
+        if (methods.contains(event.traceId)) {
+            args.insert("method", methods.value(event.traceId));
+        }
+        traceEvents.append(QJsonObject {
+            { "name", QString::fromLatin1(event.name) },
+            { "cat", "call" },
+            { "ph", "X" },
+            { "ts", last.value() },
+            { "dur", usecs - last.value() },
+            { "pid", pid },
+            { "tid", qint64(event.traceId) },
+            { "args", args },
+        });
+        last.value() = usecs;
+    }
+
+    QJsonObject trace {
+        { "traceEvents", traceEvents },
+        { "displayTimeUnit", "ms" },
+    };
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+QString Tracer::writeChromeTrace() const
+{
+    QDir cacheDir(QStandardPaths::writableLocation(
+        QStandardPaths::CacheLocation));
+    cacheDir.mkpath(".");
+    QString fileName = cacheDir.filePath(QString("trace-%1-%2.json").
+        arg(QCoreApplication::applicationPid()).
+        arg(QDateTime::currentDateTime().toString("yyyyMMddhhmmss")));
+
+    QSaveFile file(fileName);
+    if (Q_UNLIKELY(!file.open(QIODevice::WriteOnly))) {
+        qWarning() << "Couldn't write trace to" << fileName;
+        return QString();
+    }
+    file.write(toChromeTrace());
+    if (Q_UNLIKELY(!file.commit())) {
+        qWarning() << "Couldn't write trace to" << fileName <<
+            file.errorString();
+        return QString();
+    }
+    return fileName;
+}
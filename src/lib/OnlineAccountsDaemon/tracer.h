@@ -0,0 +1,66 @@
+/*
+ * This file is part of OnlineAccountsDaemon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ONLINE_ACCOUNTS_DAEMON_TRACER_H
+#define ONLINE_ACCOUNTS_DAEMON_TRACER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+
+namespace OnlineAccountsDaemon {
+
+/* Keeps the latest span events of the D-Bus calls in a ring buffer. Each
+ * call gets its own trace ID. */
+class Tracer
+{
+public:
+    static Tracer *instance();
+
+    quint32 newTraceId() { return ++m_lastTraceId; }
+
+    /* The event name must be a string literal */
+    void addEvent(quint32 traceId, const char *name,
+                  const QString &detail = QString());
+
+    QByteArray toChromeTrace() const;
+    QString writeChromeTrace() const;
+
+private:
+    Tracer();
+
+    struct Event {
+        Event(): traceId(0), name(0), timestamp(0) {}
+        quint32 traceId;
+        const char *name;
+        qint64 timestamp;
+        QString detail;
+    };
+
+    QElapsedTimer m_clock;
+    QVector<Event> m_events;
+    int m_nextEvent;
+    quint32 m_lastTraceId;
+};
+
+} // namespace
+
+#endif // ONLINE_ACCOUNTS_DAEMON_TRACER_H
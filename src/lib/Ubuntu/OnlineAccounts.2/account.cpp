@@ -127,6 +127,8 @@ void AccountPrivate::onAuthenticationFinished()
  * \li \c Account.ErrorCodeUserCanceled - The operation was canceled by the user
  * \li \c Account.ErrorCodePermissionDenied - The application has no
  *     permission to complete the operation
+ * \li \c Account.ErrorCodeThrottled - The application made too many requests
+ *     in a short time; the operation can be retried later
  * \endlist
  */
 
@@ -66,6 +66,7 @@ public:
         ErrorCodeUserCanceled,
         ErrorCodePermissionDenied,
         ErrorCodeInteractionRequired,
+        ErrorCodeThrottled,
     };
 
     explicit Account(OnlineAccounts::Account *account, QJSEngine *engine,
@@ -0,0 +1,266 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include "daemon_interface.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusPendingCall>
+#include <QDBusServiceWatcher>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QVector>
+#include <cstdlib>
+
+/* Measures how long a client waits for its first reply when the daemon is
+ * not running and gets activated by the bus, as it happens after every
+ * idle exit. The daemon's startup timings break the latency down by phase.
+ *
+ * The first activation of each run finds no saved state; the following ones
+ * restore the state saved by the previous instance. */
+
+namespace {
+
+bool waitForExit(const QDBusConnection &connection, int timeoutMs)
+{
+    QDBusServiceWatcher watcher(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                connection,
+                                QDBusServiceWatcher::WatchForUnregistration);
+    if (!connection.interface()->isServiceRegistered(
+            ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME)) {
+        return true;
+    }
+
+    QEventLoop loop;
+    QObject::connect(&watcher, SIGNAL(serviceUnregistered(const QString&)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(timeoutMs, &loop, SLOT(quit()));
+    loop.exec();
+    return !connection.interface()->isServiceRegistered(
+        ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME);
+}
+
+} // namespace
+
+class ActivationBenchmark
+{
+public:
+    ActivationBenchmark(const QString &dataDir):
+        m_generator(dataDir) {}
+
+    bool populateDb(int accountCount);
+    QJsonObject run(int activations, int idleTimeout);
+
+private:
+    QJsonObject activate(DBusService *dbus, int iteration);
+
+private:
+    AccountsDbGenerator m_generator;
+};
+
+bool ActivationBenchmark::populateDb(int accountCount)
+{
+    m_generator.setAccountCount(accountCount);
+    return m_generator.generate();
+}
+
+QJsonObject ActivationBenchmark::activate(DBusService *dbus, int iteration)
+{
+    QDBusConnection connection = dbus->sessionConnection();
+    DaemonInterface daemon(connection);
+    QVariantMap filters {
+        { "applicationId", AccountsDbGenerator::applicationId(0) },
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    QDBusPendingCall call = daemon.getAccounts(filters);
+    call.waitForFinished();
+    qint64 totalUs = timer.nsecsElapsed() / 1000;
+    if (Q_UNLIKELY(call.isError())) {
+        qWarning() << "GetAccounts failed:" << call.error().message();
+    }
+
+    /* Microseconds since the process started */
+    QVariantMap phases =
+        callDebugMethod(connection, "GetStartupTimings").toMap();
+    qint64 firstReplyUs = phases.value("firstReply").toLongLong();
+
+    qDebug() << "Activation" << iteration << "accounts:" <<
+        m_generator.accountCount() << "latency (us):" << totalUs;
+
+    return QJsonObject {
+        { "iteration", iteration },
+        { "error", call.isError() },
+        { "totalUs", totalUs },
+        /* Spent by the bus and by the kernel before the process started, and
+         * in delivering the reply */
+        { "activationOverheadUs", totalUs - firstReplyUs },
+        { "phasesUs", QJsonObject::fromVariantMap(phases) },
+    };
+}
+
+QJsonObject ActivationBenchmark::run(int activations, int idleTimeout)
+{
+    /* Each run starts without any saved state */
+    QTemporaryDir cacheDir;
+    qputenv("XDG_CACHE_HOME", cacheDir.path().toUtf8());
+    qputenv("OAD_TIMEOUT", QByteArray::number(idleTimeout));
+
+    DBusService *dbus = new DBusService;
+    dbus->startServices();
+    QDBusConnection connection = dbus->sessionConnection();
+    dbus->dbusApparmor().setCredentials(connection.baseService(), {
+        { "LinuxSecurityLabel", QByteArray("unconfined") },
+    });
+
+    QJsonArray results;
+    QVector<qint64> warmLatencies;
+    QMap<QString,QVector<qint64>> warmPhases;
+    int exitTimeoutMs = (idleTimeout + 10) * 1000;
+    for (int i = 0; i < activations; i++) {
+        if (!waitForExit(connection, exitTimeoutMs)) {
+            qWarning() << "The daemon did not exit";
+            break;
+        }
+
+        QJsonObject result = activate(dbus, i);
+        results.append(result);
+        if (i == 0) continue;
+
+        warmLatencies.append(result["totalUs"].toVariant().toLongLong());
+        QJsonObject phases = result["phasesUs"].toObject();
+        for (auto p = phases.begin(); p != phases.end(); p++) {
+            warmPhases[p.key()].append(p.value().toVariant().toLongLong());
+        }
+        warmPhases["activationOverhead"].append(
+            result["activationOverheadUs"].toVariant().toLongLong());
+    }
+    waitForExit(connection, exitTimeoutMs);
+    delete dbus;
+
+    QJsonObject phaseStats;
+    for (auto p = warmPhases.begin(); p != warmPhases.end(); p++) {
+        phaseStats.insert(p.key(), latencyStats(p.value()));
+    }
+
+    return QJsonObject {
+        { "accounts", m_generator.accountCount() },
+        { "activations", results },
+        { "firstActivationUs", results.isEmpty() ?
+            QJsonValue() : results[0].toObject()["totalUs"] },
+        { "warmActivationUs", latencyStats(warmLatencies) },
+        { "warmPhasesUs", phaseStats },
+    };
+}
+
+static QList<int> parseIntList(const QString &value)
+{
+    QList<int> list;
+    Q_FOREACH(const QString &item, value.split(',', QString::SkipEmptyParts)) {
+        bool ok;
+        int n = item.toInt(&ok);
+        if (ok && n > 0) list.append(n);
+    }
+    return list;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the activation latency of "
+                                     "accountd");
+    parser.addHelpOption();
+    QCommandLineOption accountsOption("accounts",
+        "Comma-separated list of account DB sizes", "list",
+        "10,100,1000,5000");
+    QCommandLineOption activationsOption("activations",
+        "Number of activations for each DB size", "count", "10");
+    QCommandLineOption idleTimeoutOption("idle-timeout",
+        "Inactivity timeout of the daemon, in seconds", "seconds", "1");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(accountsOption);
+    parser.addOption(activationsOption);
+    parser.addOption(idleTimeoutOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    QList<int> accountCounts = parseIntList(parser.value(accountsOption));
+    int activations = parser.value(activationsOption).toInt();
+    int idleTimeout = parser.value(idleTimeoutOption).toInt();
+    if (accountCounts.isEmpty() || activations <= 0 || idleTimeout <= 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    /* The accounts DB and the catalog files are set by the generator; the
+     * cache directory is replaced at each run */
+    QTemporaryDir accountsDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+
+    qputenv("SSO_USE_PEER_BUS", "0");
+
+    qputenv("OAD_TESTING", "1");
+    qputenv("OAD_DEBUG_INTERFACE", "1");
+
+    ActivationBenchmark benchmark(accountsDir.path());
+    QJsonArray results;
+    Q_FOREACH(int accountCount, accountCounts) {
+        if (!benchmark.populateDb(accountCount)) {
+            return EXIT_FAILURE;
+        }
+        results.append(benchmark.run(activations, idleTimeout));
+    }
+
+    QJsonObject report {
+        { "benchmark", "bench_activation" },
+        { "results", results },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,391 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include "daemon_interface.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QVector>
+#include <cstdlib>
+
+/* Measures the throughput and latency of the daemon's D-Bus methods, with a
+ * varying number of concurrent clients and accounts, for both unconfined and
+ * confined clients. The services the daemon talks to are the same mocks used
+ * by the functional tests. */
+
+namespace {
+
+enum Method {
+    GetAccounts = 0,
+    /* GetAccounts filtered by applicationId, as the client library does */
+    GetApplicationAccounts,
+    Authenticate,
+    RequestAccess,
+};
+
+const char *methodNames[] = {
+    "GetAccounts",
+    "GetAccounts(applicationId)",
+    "Authenticate",
+    "RequestAccess",
+};
+
+/* Security context of confined clients: an app from the package the
+ * generated services belong to */
+const QByteArray confinedContext("com.ubuntu.gen_application-0_0.1");
+
+} // namespace
+
+/* Each client has its own bus connection, so that the daemon sees it as a
+ * distinct peer. Calls are issued back to back: a client has at most one
+ * call in flight. */
+class BenchmarkClient: public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchmarkClient(const QString &busAddress, int index,
+                    uint accountId, const QString &serviceId,
+                    QObject *parent = 0);
+    ~BenchmarkClient();
+
+    QString uniqueName() const { return m_connection.baseService(); }
+
+    void start(Method method, int calls);
+
+    const QVector<qint64> &latencies() const { return m_latencies; }
+    int errors() const { return m_errors; }
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void onCallFinished(QDBusPendingCallWatcher *watcher);
+
+private:
+    void makeCall();
+
+private:
+    QDBusConnection m_connection;
+    DaemonInterface *m_daemon;
+    uint m_accountId;
+    QString m_serviceId;
+    Method m_method;
+    int m_remainingCalls;
+    int m_errors;
+    QElapsedTimer m_timer;
+    QVector<qint64> m_latencies;
+};
+
+BenchmarkClient::BenchmarkClient(const QString &busAddress, int index,
+                                 uint accountId, const QString &serviceId,
+                                 QObject *parent):
+    QObject(parent),
+    m_connection(QDBusConnection::connectToBus(busAddress,
+                                               QString("client-%1").
+                                               arg(index))),
+    m_daemon(new DaemonInterface(m_connection, this)),
+    m_accountId(accountId),
+    m_serviceId(serviceId),
+    m_method(GetAccounts),
+    m_remainingCalls(0),
+    m_errors(0)
+{
+}
+
+BenchmarkClient::~BenchmarkClient()
+{
+    delete m_daemon;
+    QDBusConnection::disconnectFromBus(m_connection.name());
+}
+
+void BenchmarkClient::start(Method method, int calls)
+{
+    m_method = method;
+    m_remainingCalls = calls;
+    m_errors = 0;
+    m_latencies.clear();
+    m_latencies.reserve(calls);
+    makeCall();
+}
+
+void BenchmarkClient::makeCall()
+{
+    if (m_remainingCalls <= 0) {
+        Q_EMIT finished();
+        return;
+    }
+    m_remainingCalls--;
+
+    m_timer.start();
+    QDBusPendingCall call;
+    switch (m_method) {
+    case GetAccounts:
+        call = m_daemon->getAccounts(QVariantMap());
+        break;
+    case GetApplicationAccounts:
+        call = m_daemon->getAccounts(QVariantMap {
+            { "applicationId", AccountsDbGenerator::applicationId(0) },
+        });
+        break;
+    case Authenticate:
+        call = m_daemon->authenticate(m_accountId, m_serviceId,
+                                      false, false, QVariantMap());
+        break;
+    case RequestAccess:
+        call = m_daemon->requestAccess(m_serviceId, QVariantMap());
+        break;
+    }
+    auto watcher = new QDBusPendingCallWatcher(call, this);
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+}
+
+void BenchmarkClient::onCallFinished(QDBusPendingCallWatcher *watcher)
+{
+    m_latencies.append(m_timer.nsecsElapsed() / 1000);
+    if (Q_UNLIKELY(watcher->isError())) {
+        if (m_errors == 0) {
+            qWarning() << methodNames[m_method] << "failed:" <<
+                watcher->error().message();
+        }
+        m_errors++;
+    }
+    watcher->deleteLater();
+    makeCall();
+}
+
+class DaemonBenchmark
+{
+public:
+    DaemonBenchmark(const QString &dataDir): m_generator(dataDir) {}
+
+    bool populateDb(int accountCount);
+    QJsonArray run(const QList<int> &clientCounts, int calls);
+
+private:
+    QJsonObject runMethod(Method method, bool confined,
+                          const QList<BenchmarkClient*> &clients, int calls);
+
+private:
+    AccountsDbGenerator m_generator;
+};
+
+bool DaemonBenchmark::populateDb(int accountCount)
+{
+    m_generator.setAccountCount(accountCount);
+    return m_generator.generate();
+}
+
+QJsonArray DaemonBenchmark::run(const QList<int> &clientCounts, int calls)
+{
+    QJsonArray results;
+
+    DBusService *dbus = new DBusService;
+    dbus->startServices();
+    uint accountId = m_generator.accountIds().first();
+    QString serviceId = AccountsDbGenerator::serviceId(0, 0);
+    dbus->signond().addIdentity(m_generator.credentialsId(), QVariantMap());
+    dbus->onlineAccounts().setRequestAccessReply({
+        { "accountId", accountId },
+    });
+
+    /* Activate the daemon, so that its startup is not measured */
+    DaemonInterface *daemon = new DaemonInterface(dbus->sessionConnection());
+    daemon->getAccounts(QVariantMap()).waitForFinished();
+    delete daemon;
+
+    /* Confined clients go through the per-package access policy */
+    for (int confined = 0; confined < 2; confined++) {
+        QVariantMap credentials {
+            { "LinuxSecurityLabel",
+              confined ? confinedContext : QByteArray("unconfined") },
+        };
+        Q_FOREACH(int clientCount, clientCounts) {
+            QList<BenchmarkClient*> clients;
+            for (int i = 0; i < clientCount; i++) {
+                auto client = new BenchmarkClient(dbus->sessionBus(), i,
+                                                  accountId, serviceId);
+                dbus->dbusApparmor().setCredentials(client->uniqueName(),
+                                                    credentials);
+                clients.append(client);
+            }
+
+            for (int m = GetAccounts; m <= RequestAccess; m++) {
+                results.append(runMethod(Method(m), confined, clients, calls));
+            }
+
+            qDeleteAll(clients);
+        }
+    }
+
+    delete dbus;
+    return results;
+}
+
+QJsonObject DaemonBenchmark::runMethod(Method method, bool confined,
+                                       const QList<BenchmarkClient*> &clients,
+                                       int calls)
+{
+    /* Split the calls among the clients */
+    int callsPerClient = qMax(1, calls / clients.count());
+
+    QEventLoop loop;
+    int running = clients.count();
+    Q_FOREACH(BenchmarkClient *client, clients) {
+        QObject::connect(client, &BenchmarkClient::finished,
+                         &loop, [&running, &loop]() {
+            if (--running == 0) loop.quit();
+        });
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    Q_FOREACH(BenchmarkClient *client, clients) {
+        client->start(method, callsPerClient);
+    }
+    if (running > 0) loop.exec();
+    qint64 elapsedUs = timer.nsecsElapsed() / 1000;
+
+    QVector<qint64> latencies;
+    int errors = 0;
+    Q_FOREACH(BenchmarkClient *client, clients) {
+        latencies += client->latencies();
+        errors += client->errors();
+    }
+
+    QJsonObject result {
+        { "method", methodNames[method] },
+        { "confined", confined },
+        { "accounts", m_generator.accountCount() },
+        { "clients", clients.count() },
+        { "calls", latencies.count() },
+        { "errors", errors },
+        { "elapsedUs", elapsedUs },
+        { "callsPerSecond", elapsedUs > 0 ?
+            latencies.count() * 1000000.0 / elapsedUs : 0.0 },
+        { "latencyUs", latencyStats(latencies) },
+    };
+    qDebug() << methodNames[method] << (confined ? "confined" : "") <<
+        "accounts:" <<
+        m_generator.accountCount() <<
+        "clients:" << clients.count() << "calls/s:" <<
+        result["callsPerSecond"].toDouble();
+    return result;
+}
+
+static QList<int> parseIntList(const QString &value)
+{
+    QList<int> list;
+    Q_FOREACH(const QString &item, value.split(',', QString::SkipEmptyParts)) {
+        bool ok;
+        int n = item.toInt(&ok);
+        if (ok && n > 0) list.append(n);
+    }
+    return list;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the accountd D-Bus methods");
+    parser.addHelpOption();
+    QCommandLineOption accountsOption("accounts",
+        "Comma-separated list of account DB sizes", "list",
+        "10,100,1000,5000");
+    QCommandLineOption clientsOption("clients",
+        "Comma-separated list of concurrent client counts", "list",
+        "1,10,100");
+    QCommandLineOption callsOption("calls",
+        "Number of calls per method and configuration", "count", "1000");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(accountsOption);
+    parser.addOption(clientsOption);
+    parser.addOption(callsOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    QList<int> accountCounts = parseIntList(parser.value(accountsOption));
+    QList<int> clientCounts = parseIntList(parser.value(clientsOption));
+    int calls = parser.value(callsOption).toInt();
+    if (accountCounts.isEmpty() || clientCounts.isEmpty() || calls <= 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    /* The accounts DB and the catalog files are set by the generator */
+    QTemporaryDir accountsDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+    qputenv("XDG_CACHE_HOME", accountsDir.path().toUtf8());
+
+    qputenv("SSO_USE_PEER_BUS", "0");
+
+    qputenv("OAD_TIMEOUT", "300");
+    qputenv("OAD_TESTING", "1");
+
+    DaemonBenchmark benchmark(accountsDir.path());
+    QJsonArray results;
+    Q_FOREACH(int accountCount, accountCounts) {
+        if (!benchmark.populateDb(accountCount)) {
+            return EXIT_FAILURE;
+        }
+        Q_FOREACH(const QJsonValue &result,
+                  benchmark.run(clientCounts, calls)) {
+            results.append(result);
+        }
+    }
+
+    QJsonObject report {
+        { "benchmark", "bench_daemon" },
+        { "results", results },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#include "bench_daemon.moc"
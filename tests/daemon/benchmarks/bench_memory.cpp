@@ -0,0 +1,264 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include "daemon_interface.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusPendingCall>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <cstdlib>
+
+/* Measures the heap usage of the daemon, broken down by subsystem, after
+ * registering a number of clients, after activating some accounts and after
+ * loading the whole accounts DB. The daemon collects the data itself, when
+ * started with OAD_HEAP_ACCOUNTING set. */
+
+namespace {
+
+bool getAccounts(DaemonInterface *daemon, const QVariantMap &filters)
+{
+    QDBusPendingCall call = daemon->getAccounts(filters);
+    call.waitForFinished();
+    if (Q_UNLIKELY(call.isError())) {
+        qWarning() << "GetAccounts failed:" << call.error().message();
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+class MemoryBenchmark
+{
+public:
+    MemoryBenchmark(const QString &dataDir);
+
+    bool populateDb(int accountCount);
+    QJsonObject run(int clientCount, int activeAccountCount);
+
+private:
+    QJsonObject measure(const QString &stage);
+
+private:
+    AccountsDbGenerator m_generator;
+    DBusService *m_dbus;
+};
+
+MemoryBenchmark::MemoryBenchmark(const QString &dataDir):
+    m_generator(dataDir),
+    m_dbus(0)
+{
+    /* One service per account, so that each active account is exactly one
+     * account in the DB */
+    m_generator.setServicesPerAccount(1);
+}
+
+bool MemoryBenchmark::populateDb(int accountCount)
+{
+    m_generator.setAccountCount(accountCount);
+    return m_generator.generate();
+}
+
+QJsonObject MemoryBenchmark::measure(const QString &stage)
+{
+    QDBusConnection connection = m_dbus->sessionConnection();
+    QVariantMap heapUsage =
+        callDebugMethod(connection, "GetHeapUsage").toMap();
+    QVariantMap statistics =
+        callDebugMethod(connection, "GetStatistics").toMap();
+
+    QJsonObject result = QJsonObject::fromVariantMap(heapUsage);
+    result.insert("stage", stage);
+    result.insert("manager",
+                  QJsonObject::fromVariantMap(statistics["manager"].toMap()));
+    qDebug() << stage << "heap:" << heapUsage["heapBytes"].toLongLong();
+    return result;
+}
+
+QJsonObject MemoryBenchmark::run(int clientCount, int activeAccountCount)
+{
+    /* A new cache directory, so that the daemon doesn't restore the clients
+     * and accounts of the previous run */
+    QTemporaryDir cacheDir;
+    qputenv("XDG_CACHE_HOME", cacheDir.path().toUtf8());
+
+    m_dbus = new DBusService;
+    m_dbus->startServices();
+
+    QVariantMap credentials {
+        { "LinuxSecurityLabel", QByteArray("unconfined") },
+    };
+    QDBusConnection connection = m_dbus->sessionConnection();
+    m_dbus->dbusApparmor().setCredentials(connection.baseService(),
+                                          credentials);
+
+    /* The daemon is activated by the first call */
+    QJsonArray stages;
+    stages.append(measure("activated"));
+
+    QList<uint> accountIds = m_generator.accountIds();
+    QVariantMap firstAccount {
+        { "accountId", accountIds.first() },
+    };
+
+    QList<QDBusConnection> clients;
+    for (int i = 0; i < clientCount; i++) {
+        QDBusConnection client =
+            QDBusConnection::connectToBus(m_dbus->sessionBus(),
+                                          QString("client-%1").arg(i));
+        m_dbus->dbusApparmor().setCredentials(client.baseService(),
+                                              credentials);
+        DaemonInterface daemon(client);
+        getAccounts(&daemon, firstAccount);
+        clients.append(client);
+    }
+    stages.append(measure("clients"));
+
+    DaemonInterface daemon(connection);
+    int activeAccounts = qMin(activeAccountCount, accountIds.count());
+    for (int i = 0; i < activeAccounts; i++) {
+        getAccounts(&daemon, QVariantMap {{ "accountId", accountIds[i] }});
+    }
+    stages.append(measure("activeAccounts"));
+
+    getAccounts(&daemon, QVariantMap());
+    stages.append(measure("allAccounts"));
+
+    Q_FOREACH(const QDBusConnection &client, clients) {
+        QDBusConnection::disconnectFromBus(client.name());
+    }
+    delete m_dbus;
+    m_dbus = 0;
+
+    /* The cost of each item is estimated from the growth of the heap
+     * between consecutive stages */
+    auto heapAt = [&stages](int stage) {
+        return stages[stage].toObject().value("heapBytes").toDouble();
+    };
+    int otherAccounts = accountIds.count() - activeAccounts;
+    QJsonObject perItem {
+        { "client", clientCount > 0 ?
+            (heapAt(1) - heapAt(0)) / clientCount : 0.0 },
+        { "activeAccount", activeAccounts > 0 ?
+            (heapAt(2) - heapAt(1)) / activeAccounts : 0.0 },
+        { "account", otherAccounts > 0 ?
+            (heapAt(3) - heapAt(2)) / otherAccounts : 0.0 },
+    };
+
+    return QJsonObject {
+        { "accounts", m_generator.accountCount() },
+        { "clients", clientCount },
+        { "activeAccounts", activeAccounts },
+        { "stages", stages },
+        { "bytesPerItem", perItem },
+    };
+}
+
+static QList<int> parseIntList(const QString &value)
+{
+    QList<int> list;
+    Q_FOREACH(const QString &item, value.split(',', QString::SkipEmptyParts)) {
+        bool ok;
+        int n = item.toInt(&ok);
+        if (ok && n > 0) list.append(n);
+    }
+    return list;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the heap usage of accountd");
+    parser.addHelpOption();
+    QCommandLineOption accountsOption("accounts",
+        "Comma-separated list of account DB sizes", "list",
+        "100,1000,5000");
+    QCommandLineOption clientsOption("clients",
+        "Number of clients to register", "count", "100");
+    QCommandLineOption activeAccountsOption("active-accounts",
+        "Number of accounts to activate before loading the whole DB",
+        "count", "50");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(accountsOption);
+    parser.addOption(clientsOption);
+    parser.addOption(activeAccountsOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    QList<int> accountCounts = parseIntList(parser.value(accountsOption));
+    int clientCount = parser.value(clientsOption).toInt();
+    int activeAccountCount = parser.value(activeAccountsOption).toInt();
+    if (accountCounts.isEmpty() || clientCount < 0 ||
+        activeAccountCount < 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    QTemporaryDir accountsDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+
+    qputenv("SSO_USE_PEER_BUS", "0");
+
+    qputenv("OAD_TIMEOUT", "300");
+    qputenv("OAD_TESTING", "1");
+    qputenv("OAD_DEBUG_INTERFACE", "1");
+    qputenv("OAD_HEAP_ACCOUNTING", "1");
+
+    MemoryBenchmark benchmark(accountsDir.path());
+    QJsonArray results;
+    Q_FOREACH(int accountCount, accountCounts) {
+        if (!benchmark.populateDb(accountCount)) {
+            return EXIT_FAILURE;
+        }
+        results.append(benchmark.run(clientCount, activeAccountCount));
+    }
+
+    QJsonObject report {
+        { "benchmark", "bench_memory" },
+        { "results", results },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
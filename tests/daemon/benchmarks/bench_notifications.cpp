@@ -0,0 +1,532 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccounts/Account"
+#include "OnlineAccounts/Manager"
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include <Accounts/Account>
+#include <Accounts/Manager>
+#include <Accounts/Service>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+/* Measures how long it takes for a change made through libaccounts to reach
+ * the clients, as an Account::changed() signal emitted by the client library.
+ * The accounts are modified at a controlled rate, while a varying number of
+ * clients, each with its own bus connection, are watching the same account.
+ *
+ * The daemon broadcasts AccountChanged to every client on the bus; besides
+ * the subscribed clients, some "bystander" clients which are not interested
+ * in the changed account can be added, to measure the cost of the broadcast
+ * delivery on the rest of the session.
+ *
+ * All the clients live in this process and share its event loop, so each of
+ * them handles a change only after the ones dispatched before it: besides
+ * the latency of all the deliveries, the latency of the first delivery of
+ * each change (what a client in its own process would see) and the spread
+ * added by the dispatch order are reported separately. */
+
+namespace {
+
+/* Used to tell the account changes apart */
+const QString sequenceKey = QStringLiteral("notificationSequence");
+
+const int drainTimeoutMs = 5000;
+
+} // namespace
+
+struct NotificationStats {
+    NotificationStats() { clock.start(); }
+
+    QElapsedTimer clock;
+    QHash<int,qint64> changeTimes;
+    /* When each client handled the change, by sequence number */
+    QHash<int,QVector<qint64> > deliveryTimes;
+    QVector<qint64> latencies;
+};
+
+class NotificationClient: public QObject
+{
+    Q_OBJECT
+
+public:
+    NotificationClient(const QString &busAddress, const QString &name,
+                       NotificationStats *stats, QObject *parent = 0);
+    ~NotificationClient();
+
+    QString uniqueName() const { return m_connection.baseService(); }
+
+    /* Creates the client library's Manager; the bus credentials must have
+     * been set before this is called. */
+    bool start(const QString &applicationId);
+
+    /* Connects to the changed() signal of the given account */
+    bool watch(OnlineAccounts::AccountId accountId, const QString &serviceId);
+
+    OnlineAccounts::Manager *manager() const { return m_manager; }
+
+    void reset();
+    int lastSequence() const { return m_lastSequence; }
+    int changedSignals() const { return m_changedSignals; }
+    int busSignals() const { return m_busSignals; }
+
+private Q_SLOTS:
+    void onAccountChanged();
+    void onBusSignal();
+
+private:
+    QDBusConnection m_connection;
+    OnlineAccounts::Manager *m_manager;
+    OnlineAccounts::Account *m_account;
+    NotificationStats *m_stats;
+    int m_lastSequence;
+    int m_changedSignals;
+    int m_busSignals;
+};
+
+NotificationClient::NotificationClient(const QString &busAddress,
+                                       const QString &name,
+                                       NotificationStats *stats,
+                                       QObject *parent):
+    QObject(parent),
+    m_connection(QDBusConnection::connectToBus(busAddress, name)),
+    m_manager(0),
+    m_account(0),
+    m_stats(stats),
+    m_lastSequence(0),
+    m_changedSignals(0),
+    m_busSignals(0)
+{
+    /* Counts the signals as they arrive on the wire, whether the client
+     * library is interested in them or not */
+    m_connection.connect(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                         ONLINE_ACCOUNTS_MANAGER_PATH,
+                         ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                         "AccountChanged",
+                         this, SLOT(onBusSignal()));
+}
+
+NotificationClient::~NotificationClient()
+{
+    delete m_manager;
+    QDBusConnection::disconnectFromBus(m_connection.name());
+}
+
+bool NotificationClient::start(const QString &applicationId)
+{
+    m_manager = new OnlineAccounts::Manager(applicationId, m_connection);
+    m_manager->waitForReady();
+    return m_manager->isReady();
+}
+
+bool NotificationClient::watch(OnlineAccounts::AccountId accountId,
+                               const QString &serviceId)
+{
+    Q_FOREACH(OnlineAccounts::Account *account,
+              m_manager->availableAccounts(serviceId)) {
+        if (account->id() == accountId) {
+            m_account = account;
+            QObject::connect(account, SIGNAL(changed()),
+                             this, SLOT(onAccountChanged()));
+            return true;
+        }
+    }
+    return false;
+}
+
+void NotificationClient::reset()
+{
+    m_lastSequence = 0;
+    m_changedSignals = 0;
+    m_busSignals = 0;
+}
+
+void NotificationClient::onAccountChanged()
+{
+    m_changedSignals++;
+
+    int sequence = m_account->setting(sequenceKey).toInt();
+    auto i = m_stats->changeTimes.constFind(sequence);
+    if (i != m_stats->changeTimes.constEnd()) {
+        qint64 now = m_stats->clock.nsecsElapsed();
+        m_stats->latencies.append((now - i.value()) / 1000);
+        m_stats->deliveryTimes[sequence].append(now);
+    }
+    m_lastSequence = qMax(m_lastSequence, sequence);
+}
+
+void NotificationClient::onBusSignal()
+{
+    m_busSignals++;
+}
+
+class NotificationBenchmark
+{
+public:
+    NotificationBenchmark(DBusService *dbus, AccountsDbGenerator *generator);
+    ~NotificationBenchmark();
+
+    bool setClients(int subscribers, int bystanders);
+    QJsonObject run(double rate, int changes);
+
+private:
+    NotificationClient *createClient(const QString &name,
+                                     const QString &applicationId);
+    void makeChange(int sequence);
+    bool allDelivered(int sequence) const;
+
+private:
+    DBusService *m_dbus;
+    AccountsDbGenerator *m_generator;
+    NotificationStats m_stats;
+    QList<NotificationClient*> m_subscribers;
+    QList<NotificationClient*> m_bystanders;
+    int m_sequence;
+    Accounts::Manager *m_manager;
+    Accounts::Account *m_account;
+    Accounts::Service m_service;
+};
+
+NotificationBenchmark::NotificationBenchmark(DBusService *dbus,
+                                             AccountsDbGenerator *generator):
+    m_dbus(dbus),
+    m_generator(generator),
+    m_sequence(0),
+    m_manager(new Accounts::Manager),
+    m_account(0)
+{
+}
+
+NotificationBenchmark::~NotificationBenchmark()
+{
+    qDeleteAll(m_subscribers);
+    qDeleteAll(m_bystanders);
+    delete m_manager;
+}
+
+NotificationClient *
+NotificationBenchmark::createClient(const QString &name,
+                                    const QString &applicationId)
+{
+    auto client = new NotificationClient(m_dbus->sessionBus(), name,
+                                         &m_stats);
+    m_dbus->dbusApparmor().setCredentials(client->uniqueName(), {
+        { "LinuxSecurityLabel", QByteArray("unconfined") },
+    });
+    if (Q_UNLIKELY(!client->start(applicationId))) {
+        qWarning() << "Client" << name << "did not get ready";
+        delete client;
+        return 0;
+    }
+    return client;
+}
+
+bool NotificationBenchmark::setClients(int subscribers, int bystanders)
+{
+    QString applicationId = AccountsDbGenerator::applicationId(0);
+    QString serviceId = AccountsDbGenerator::serviceId(0, 0);
+
+    while (m_subscribers.count() < subscribers) {
+        auto client = createClient(QString("subscriber-%1").
+                                   arg(m_subscribers.count()),
+                                   applicationId);
+        if (!client) return false;
+        m_subscribers.append(client);
+    }
+    while (m_subscribers.count() > subscribers) {
+        delete m_subscribers.takeLast();
+    }
+
+    /* Bystanders act as an application which does not use the changed
+     * service, so they should not need to hear about it */
+    while (m_bystanders.count() < bystanders) {
+        auto client = createClient(QString("bystander-%1").
+                                   arg(m_bystanders.count()),
+                                   AccountsDbGenerator::applicationId(1));
+        if (!client) return false;
+        m_bystanders.append(client);
+    }
+    while (m_bystanders.count() > bystanders) {
+        delete m_bystanders.takeLast();
+    }
+
+    if (!m_account) {
+        QList<OnlineAccounts::Account*> accounts =
+            m_subscribers.first()->manager()->availableAccounts(serviceId);
+        if (Q_UNLIKELY(accounts.isEmpty())) {
+            qWarning() << "No accounts for" << serviceId;
+            return false;
+        }
+        m_account = m_manager->account(accounts.first()->id());
+        m_service = m_manager->service(serviceId);
+    }
+
+    Q_FOREACH(NotificationClient *client, m_subscribers) {
+        if (!client->watch(m_account->id(), m_service.name())) {
+            qWarning() << "Account" << m_account->id() << "not visible";
+            return false;
+        }
+    }
+    return true;
+}
+
+void NotificationBenchmark::makeChange(int sequence)
+{
+    m_account->selectService(m_service);
+    m_account->setValue(sequenceKey, sequence);
+    m_stats.changeTimes.insert(sequence, m_stats.clock.nsecsElapsed());
+    m_account->syncAndBlock();
+}
+
+bool NotificationBenchmark::allDelivered(int sequence) const
+{
+    Q_FOREACH(NotificationClient *client, m_subscribers) {
+        if (client->lastSequence() < sequence) return false;
+    }
+    return true;
+}
+
+QJsonObject NotificationBenchmark::run(double rate, int changes)
+{
+    m_stats.changeTimes.clear();
+    m_stats.deliveryTimes.clear();
+    m_stats.latencies.clear();
+    Q_FOREACH(NotificationClient *client, m_subscribers + m_bystanders) {
+        client->reset();
+    }
+
+    /* Sequence numbers keep growing across runs, so that every change
+     * really modifies the account */
+    int firstSequence = m_sequence + 1;
+    int lastSequence = m_sequence + changes;
+
+    QEventLoop loop;
+    QTimer tickTimer;
+    tickTimer.setInterval(qMax(1, int(1000 / rate)));
+    QElapsedTimer timer;
+    timer.start();
+    QObject::connect(&tickTimer, &QTimer::timeout, [&]() {
+        /* Catch up with the changes which should have been made by now, so
+         * that the timer granularity doesn't affect the rate */
+        int due = qMin(lastSequence,
+                       firstSequence + int(timer.nsecsElapsed() / 1e9 * rate));
+        while (m_sequence < due) {
+            makeChange(++m_sequence);
+        }
+        if (m_sequence >= lastSequence) {
+            tickTimer.stop();
+            loop.quit();
+        }
+    });
+    tickTimer.start();
+    loop.exec();
+    qint64 elapsedUs = timer.nsecsElapsed() / 1000;
+
+    QElapsedTimer drainTimer;
+    drainTimer.start();
+    while (!allDelivered(lastSequence) &&
+           drainTimer.elapsed() < drainTimeoutMs) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    }
+    /* Let the bystanders catch up, too */
+    QCoreApplication::processEvents();
+
+    int minChanged = INT_MAX, maxChanged = 0, totalChanged = 0;
+    int subscriberBusSignals = 0;
+    Q_FOREACH(NotificationClient *client, m_subscribers) {
+        minChanged = qMin(minChanged, client->changedSignals());
+        maxChanged = qMax(maxChanged, client->changedSignals());
+        totalChanged += client->changedSignals();
+        subscriberBusSignals += client->busSignals();
+    }
+    int bystanderBusSignals = 0;
+    Q_FOREACH(NotificationClient *client, m_bystanders) {
+        bystanderBusSignals += client->busSignals();
+    }
+
+    QVector<qint64> firstLatencies, dispatchSpreads;
+    for (auto i = m_stats.deliveryTimes.constBegin();
+         i != m_stats.deliveryTimes.constEnd(); i++) {
+        auto range = std::minmax_element(i.value().constBegin(),
+                                         i.value().constEnd());
+        firstLatencies.append((*range.first -
+                               m_stats.changeTimes.value(i.key())) / 1000);
+        dispatchSpreads.append((*range.second - *range.first) / 1000);
+    }
+
+    int subscribers = m_subscribers.count();
+    int bystanders = m_bystanders.count();
+    QJsonObject result {
+        /* The only mode the daemon supports: AccountChanged is emitted
+         * once, and the bus delivers it to every client with a match */
+        { "delivery", "broadcast" },
+        { "accounts", m_generator->accountCount() },
+        { "subscribers", subscribers },
+        { "bystanders", bystanders },
+        { "targetRate", rate },
+        { "changes", changes },
+        { "changesPerSecond", elapsedUs > 0 ?
+            changes * 1000000.0 / elapsedUs : 0.0 },
+        { "expectedSignals", changes * subscribers },
+        { "changedSignals", totalChanged },
+        { "minChangedPerClient", minChanged },
+        { "maxChangedPerClient", maxChanged },
+        { "busSignalsPerSubscriber", subscribers > 0 ?
+            double(subscriberBusSignals) / subscribers : 0.0 },
+        { "busSignalsPerBystander", bystanders > 0 ?
+            double(bystanderBusSignals) / bystanders : 0.0 },
+        { "allDelivered", allDelivered(lastSequence) },
+        { "latencyUs", latencyStats(m_stats.latencies) },
+        { "firstDeliveryLatencyUs", latencyStats(firstLatencies) },
+        { "dispatchSpreadUs", latencyStats(dispatchSpreads) },
+    };
+    qDebug() << "Subscribers:" << subscribers << "bystanders:" <<
+        bystanders << "rate:" << rate << "signals:" << totalChanged <<
+        "of" << changes * subscribers;
+    return result;
+}
+
+static QList<int> parseIntList(const QString &value, int minimum = 1)
+{
+    QList<int> list;
+    Q_FOREACH(const QString &item, value.split(',', QString::SkipEmptyParts)) {
+        bool ok;
+        int n = item.toInt(&ok);
+        if (ok && n >= minimum) list.append(n);
+    }
+    return list;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the latency of account change "
+                                     "notifications from accountd");
+    parser.addHelpOption();
+    QCommandLineOption clientsOption("clients",
+        "Comma-separated list of subscribed client counts", "list",
+        "1,10,100");
+    QCommandLineOption bystandersOption("bystanders",
+        "Comma-separated list of counts of clients not interested in the "
+        "changed account", "list", "0,100");
+    QCommandLineOption ratesOption("rates",
+        "Comma-separated list of account changes per second", "list",
+        "10,100");
+    QCommandLineOption changesOption("changes",
+        "Number of account changes per configuration", "count", "200");
+    QCommandLineOption accountsOption("accounts",
+        "Number of accounts in the generated DB", "count", "100");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(clientsOption);
+    parser.addOption(bystandersOption);
+    parser.addOption(ratesOption);
+    parser.addOption(changesOption);
+    parser.addOption(accountsOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    QList<int> clientCounts = parseIntList(parser.value(clientsOption));
+    QList<int> bystanderCounts = parseIntList(parser.value(bystandersOption),
+                                              0);
+    QList<int> rates = parseIntList(parser.value(ratesOption));
+    int changes = parser.value(changesOption).toInt();
+    int accountCount = parser.value(accountsOption).toInt();
+    if (clientCounts.isEmpty() || bystanderCounts.isEmpty() ||
+        rates.isEmpty() || changes <= 0 || accountCount <= 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    QTemporaryDir dataDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+    qputenv("XDG_CACHE_HOME", dataDir.path().toUtf8());
+    qputenv("SSO_USE_PEER_BUS", "0");
+    qputenv("OAD_TIMEOUT", "300");
+    qputenv("OAD_TESTING", "1");
+
+    /* libaccounts keeps its bus connection for the whole life of the
+     * process, so all the runs share the same bus and accounts DB. */
+    AccountsDbGenerator generator(dataDir.path());
+    generator.setAccountCount(accountCount);
+    /* Each application uses the services of a different provider */
+    generator.setProviderCount(2);
+    generator.setApplicationCount(2);
+    if (!generator.generate()) {
+        return EXIT_FAILURE;
+    }
+
+    DBusService dbus;
+    dbus.startServices();
+
+    NotificationBenchmark benchmark(&dbus, &generator);
+    QJsonArray results;
+    Q_FOREACH(int clientCount, clientCounts) {
+        Q_FOREACH(int bystanderCount, bystanderCounts) {
+            if (!benchmark.setClients(clientCount, bystanderCount)) {
+                return EXIT_FAILURE;
+            }
+            Q_FOREACH(int rate, rates) {
+                results.append(benchmark.run(rate, changes));
+            }
+        }
+    }
+
+    QJsonObject report {
+        { "benchmark", "bench_notifications" },
+        { "results", results },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#include "bench_notifications.moc"
@@ -0,0 +1,54 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OAD_BENCHMARK_COMMON_H
+#define OAD_BENCHMARK_COMMON_H
+
+#include "dbus_service.h"
+#include <QJsonObject>
+#include <QVector>
+#include <algorithm>
+
+/* Summarizes a set of latencies, in microseconds */
+inline QJsonObject latencyStats(QVector<qint64> latencies)
+{
+    if (latencies.isEmpty()) return QJsonObject();
+
+    std::sort(latencies.begin(), latencies.end());
+    qint64 total = 0;
+    Q_FOREACH(qint64 latency, latencies) {
+        total += latency;
+    }
+
+    auto percentile = [&latencies](double p) {
+        int index = qMin(latencies.count() - 1, int(p * latencies.count()));
+        return latencies[index];
+    };
+
+    return QJsonObject {
+        { "mean", double(total) / latencies.count() },
+        { "p50", percentile(0.50) },
+        { "p90", percentile(0.90) },
+        { "p99", percentile(0.99) },
+        { "max", latencies.last() },
+    };
+}
+
+#endif // OAD_BENCHMARK_COMMON_H
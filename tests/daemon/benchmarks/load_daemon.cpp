@@ -0,0 +1,501 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include "daemon_interface.h"
+#include <Accounts/Account>
+#include <Accounts/Manager>
+#include <Accounts/Service>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QVector>
+#include <climits>
+#include <cstdlib>
+
+/* Keeps a mix of D-Bus calls going at a fixed rate from many clients, each
+ * with its own bus connection, while the accounts are being modified. Unlike
+ * bench_daemon, calls are not issued back to back: the rate does not depend
+ * on how fast the daemon replies. */
+
+namespace {
+
+enum Method {
+    GetAccounts = 0,
+    Authenticate,
+    RequestAccess,
+    LastMethod = RequestAccess,
+};
+
+const char *methodNames[] = {
+    "GetAccounts",
+    "Authenticate",
+    "RequestAccess",
+};
+
+/* Used to tell the account changes apart */
+const QString sequenceKey = QStringLiteral("loadSequence");
+
+} // namespace
+
+struct LoadStats {
+    LoadStats(int clientCount):
+        inFlight(0),
+        notificationsPerClient(clientCount, 0)
+    {
+        clock.start();
+    }
+
+    QElapsedTimer clock;
+    int inFlight;
+    QVector<qint64> latencies[LastMethod + 1];
+    int errors[LastMethod + 1] = {};
+    QHash<int,qint64> changeTimes;
+    QVector<qint64> notificationLags;
+    QVector<int> notificationsPerClient;
+};
+
+class LoadClient: public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadClient(const QString &busAddress, int index,
+               uint accountId, const QString &serviceId,
+               LoadStats *stats, QObject *parent = 0);
+    ~LoadClient();
+
+    QString uniqueName() const { return m_connection.baseService(); }
+
+    /* Lets the daemon know about us, so that we get notified */
+    bool subscribe();
+
+    void makeCall(Method method);
+
+private Q_SLOTS:
+    void onCallFinished(QDBusPendingCallWatcher *watcher);
+    void onAccountChanged(const QString &serviceId,
+                          const AccountInfo &account);
+
+private:
+    int m_index;
+    QDBusConnection m_connection;
+    DaemonInterface *m_daemon;
+    uint m_accountId;
+    QString m_serviceId;
+    LoadStats *m_stats;
+};
+
+LoadClient::LoadClient(const QString &busAddress, int index,
+                       uint accountId, const QString &serviceId,
+                       LoadStats *stats, QObject *parent):
+    QObject(parent),
+    m_index(index),
+    m_connection(QDBusConnection::connectToBus(busAddress,
+                                               QString("load-client-%1").
+                                               arg(index))),
+    m_daemon(new DaemonInterface(m_connection, this)),
+    m_accountId(accountId),
+    m_serviceId(serviceId),
+    m_stats(stats)
+{
+    QObject::connect(m_daemon,
+                     SIGNAL(accountChanged(const QString&,const AccountInfo&)),
+                     this,
+                     SLOT(onAccountChanged(const QString&,const AccountInfo&)));
+}
+
+LoadClient::~LoadClient()
+{
+    delete m_daemon;
+    QDBusConnection::disconnectFromBus(m_connection.name());
+}
+
+bool LoadClient::subscribe()
+{
+    QDBusPendingCall call = m_daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    if (Q_UNLIKELY(call.isError())) {
+        qWarning() << "Client" << m_index << "failed to subscribe:" <<
+            call.error().message();
+        return false;
+    }
+    return true;
+}
+
+void LoadClient::makeCall(Method method)
+{
+    QDBusPendingCall call;
+    switch (method) {
+    case GetAccounts:
+        call = m_daemon->getAccounts(QVariantMap());
+        break;
+    case Authenticate:
+        call = m_daemon->authenticate(m_accountId, m_serviceId,
+                                      false, false, QVariantMap());
+        break;
+    case RequestAccess:
+        call = m_daemon->requestAccess(m_serviceId, QVariantMap());
+        break;
+    }
+    m_stats->inFlight++;
+
+    auto watcher = new QDBusPendingCallWatcher(call, this);
+    watcher->setProperty("method", int(method));
+    watcher->setProperty("started", m_stats->clock.nsecsElapsed());
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+}
+
+void LoadClient::onCallFinished(QDBusPendingCallWatcher *watcher)
+{
+    int method = watcher->property("method").toInt();
+    qint64 started = watcher->property("started").toLongLong();
+    m_stats->latencies[method].append(
+        (m_stats->clock.nsecsElapsed() - started) / 1000);
+    if (Q_UNLIKELY(watcher->isError())) {
+        m_stats->errors[method]++;
+    }
+    m_stats->inFlight--;
+    watcher->deleteLater();
+}
+
+void LoadClient::onAccountChanged(const QString &serviceId,
+                                  const AccountInfo &account)
+{
+    Q_UNUSED(serviceId);
+
+    m_stats->notificationsPerClient[m_index]++;
+
+    QVariant sequence = account.data().value("settings/" + sequenceKey);
+    auto i = m_stats->changeTimes.constFind(sequence.toInt());
+    if (sequence.isValid() && i != m_stats->changeTimes.constEnd()) {
+        m_stats->notificationLags.append(
+            (m_stats->clock.nsecsElapsed() - i.value()) / 1000);
+    }
+}
+
+class LoadGenerator: public QObject
+{
+    Q_OBJECT
+
+public:
+    LoadGenerator(const QList<LoadClient*> &clients,
+                  const QVector<Method> &mix, LoadStats *stats,
+                  QObject *parent = 0);
+
+    void setRate(double callsPerSecond) { m_rate = callsPerSecond; }
+    void setChangeRate(double changesPerSecond);
+    void setChangedAccount(uint accountId, const QString &serviceId);
+
+    void run(int seconds);
+
+    int issuedCalls() const { return m_issuedCalls; }
+    int changes() const { return m_sequence; }
+
+private Q_SLOTS:
+    void onTick();
+    void onChangeTimeout();
+
+private:
+    QList<LoadClient*> m_clients;
+    QVector<Method> m_mix;
+    LoadStats *m_stats;
+    double m_rate;
+    int m_issuedCalls;
+    int m_sequence;
+    qint64 m_startTime;
+    QTimer m_tickTimer;
+    QTimer m_changeTimer;
+    Accounts::Manager *m_manager;
+    Accounts::Account *m_account;
+    Accounts::Service m_service;
+};
+
+LoadGenerator::LoadGenerator(const QList<LoadClient*> &clients,
+                             const QVector<Method> &mix, LoadStats *stats,
+                             QObject *parent):
+    QObject(parent),
+    m_clients(clients),
+    m_mix(mix),
+    m_stats(stats),
+    m_rate(100),
+    m_issuedCalls(0),
+    m_sequence(0),
+    m_startTime(0),
+    m_manager(new Accounts::Manager(this)),
+    m_account(0)
+{
+    m_tickTimer.setInterval(5);
+    QObject::connect(&m_tickTimer, SIGNAL(timeout()),
+                     this, SLOT(onTick()));
+    QObject::connect(&m_changeTimer, SIGNAL(timeout()),
+                     this, SLOT(onChangeTimeout()));
+}
+
+void LoadGenerator::setChangeRate(double changesPerSecond)
+{
+    if (changesPerSecond > 0) {
+        m_changeTimer.setInterval(int(1000 / changesPerSecond));
+    }
+}
+
+void LoadGenerator::setChangedAccount(uint accountId,
+                                      const QString &serviceId)
+{
+    m_account = m_manager->account(accountId);
+    m_service = m_manager->service(serviceId);
+}
+
+void LoadGenerator::run(int seconds)
+{
+    m_startTime = m_stats->clock.nsecsElapsed();
+    m_tickTimer.start();
+    if (m_account && m_changeTimer.interval() > 0) {
+        m_changeTimer.start();
+    }
+
+    QEventLoop loop;
+    QTimer::singleShot(seconds * 1000, &loop, SLOT(quit()));
+    loop.exec();
+
+    m_tickTimer.stop();
+    m_changeTimer.stop();
+}
+
+void LoadGenerator::onTick()
+{
+    /* Catch up with the calls which should have been made by now, so that
+     * the timer granularity doesn't affect the rate */
+    double elapsed = (m_stats->clock.nsecsElapsed() - m_startTime) / 1e9;
+    int dueCalls = int(elapsed * m_rate);
+    while (m_issuedCalls < dueCalls) {
+        LoadClient *client = m_clients[m_issuedCalls % m_clients.count()];
+        client->makeCall(m_mix[qrand() % m_mix.count()]);
+        m_issuedCalls++;
+    }
+}
+
+void LoadGenerator::onChangeTimeout()
+{
+    m_sequence++;
+    m_account->selectService(m_service);
+    m_account->setValue(sequenceKey, m_sequence);
+    m_stats->changeTimes.insert(m_sequence, m_stats->clock.nsecsElapsed());
+    m_account->syncAndBlock();
+}
+
+/* Parses "GetAccounts=8,Authenticate=1" into a table where each method
+ * appears as many times as its weight. */
+static QVector<Method> parseMix(const QString &value)
+{
+    QVector<Method> mix;
+    Q_FOREACH(const QString &item, value.split(',', QString::SkipEmptyParts)) {
+        QStringList parts = item.split('=');
+        int weight = parts.count() > 1 ? parts[1].toInt() : 1;
+        bool found = false;
+        for (int m = GetAccounts; m <= LastMethod; m++) {
+            if (parts[0] == methodNames[m]) {
+                mix.insert(mix.end(), qMax(weight, 0), Method(m));
+                found = true;
+            }
+        }
+        if (!found) {
+            qWarning() << "Unknown method" << parts[0];
+            return QVector<Method>();
+        }
+    }
+    return mix;
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Generates a steady load of D-Bus calls on accountd");
+    parser.addHelpOption();
+    QCommandLineOption clientsOption("clients",
+        "Number of clients, each with its own bus connection", "count", "10");
+    QCommandLineOption rateOption("rate",
+        "Total number of calls per second", "rate", "100");
+    QCommandLineOption mixOption("mix",
+        "Weights of the called methods", "mix",
+        "GetAccounts=8,Authenticate=1,RequestAccess=1");
+    QCommandLineOption durationOption("duration",
+        "Duration of the test, in seconds", "seconds", "10");
+    QCommandLineOption changeRateOption("change-rate",
+        "Account changes per second", "rate", "1");
+    QCommandLineOption accountsOption("accounts",
+        "Number of accounts in the generated DB", "count", "100");
+    QCommandLineOption seedOption("seed",
+        "Seed for choosing the methods", "seed", "1");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(clientsOption);
+    parser.addOption(rateOption);
+    parser.addOption(mixOption);
+    parser.addOption(durationOption);
+    parser.addOption(changeRateOption);
+    parser.addOption(accountsOption);
+    parser.addOption(seedOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    int clientCount = parser.value(clientsOption).toInt();
+    double rate = parser.value(rateOption).toDouble();
+    QVector<Method> mix = parseMix(parser.value(mixOption));
+    int duration = parser.value(durationOption).toInt();
+    double changeRate = parser.value(changeRateOption).toDouble();
+    int accountCount = parser.value(accountsOption).toInt();
+    if (clientCount <= 0 || rate <= 0 || mix.isEmpty() ||
+        duration <= 0 || accountCount <= 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+    qsrand(parser.value(seedOption).toUInt());
+
+    QTemporaryDir dataDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+    qputenv("XDG_CACHE_HOME", dataDir.path().toUtf8());
+    qputenv("SSO_USE_PEER_BUS", "0");
+    qputenv("OAD_TIMEOUT", QByteArray::number(duration + 60));
+    qputenv("OAD_TESTING", "1");
+
+    AccountsDbGenerator generator(dataDir.path());
+    generator.setAccountCount(accountCount);
+    if (!generator.generate()) {
+        return EXIT_FAILURE;
+    }
+    uint accountId = generator.accountIds().first();
+    QString serviceId = AccountsDbGenerator::serviceId(0, 0);
+
+    DBusService dbus;
+    dbus.startServices();
+    dbus.signond().addIdentity(generator.credentialsId(), QVariantMap());
+    dbus.onlineAccounts().setRequestAccessReply({
+        { "accountId", accountId },
+    });
+
+    LoadStats stats(clientCount);
+    QList<LoadClient*> clients;
+    QVariantMap credentials {
+        { "LinuxSecurityLabel", QByteArray("unconfined") },
+    };
+    for (int i = 0; i < clientCount; i++) {
+        auto client = new LoadClient(dbus.sessionBus(), i,
+                                     accountId, serviceId, &stats);
+        dbus.dbusApparmor().setCredentials(client->uniqueName(), credentials);
+        clients.append(client);
+    }
+    Q_FOREACH(LoadClient *client, clients) {
+        if (!client->subscribe()) return EXIT_FAILURE;
+    }
+
+    LoadGenerator loadGenerator(clients, mix, &stats);
+    loadGenerator.setRate(rate);
+    loadGenerator.setChangeRate(changeRate);
+    loadGenerator.setChangedAccount(accountId, serviceId);
+    loadGenerator.run(duration);
+
+    /* Give the calls still in flight and the last notifications some time
+     * to arrive */
+    QElapsedTimer drainTimer;
+    drainTimer.start();
+    while ((stats.inFlight > 0 || drainTimer.elapsed() < 1000) &&
+           drainTimer.elapsed() < 30000) {
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+    }
+
+    QJsonObject methods;
+    int completedCalls = 0;
+    for (int m = GetAccounts; m <= LastMethod; m++) {
+        const QVector<qint64> &latencies = stats.latencies[m];
+        if (latencies.isEmpty() && stats.errors[m] == 0) continue;
+        completedCalls += latencies.count();
+        methods.insert(methodNames[m], QJsonObject {
+            { "calls", latencies.count() },
+            { "errors", stats.errors[m] },
+            { "callsPerSecond", double(latencies.count()) / duration },
+            { "latencyUs", latencyStats(latencies) },
+        });
+    }
+
+    int minNotifications = INT_MAX, maxNotifications = 0;
+    int receivedNotifications = 0;
+    Q_FOREACH(int count, stats.notificationsPerClient) {
+        minNotifications = qMin(minNotifications, count);
+        maxNotifications = qMax(maxNotifications, count);
+        receivedNotifications += count;
+    }
+
+    QJsonObject report {
+        { "benchmark", "load_daemon" },
+        { "clients", clientCount },
+        { "accounts", accountCount },
+        { "durationSeconds", duration },
+        { "targetRate", rate },
+        { "issuedCalls", loadGenerator.issuedCalls() },
+        { "completedCalls", completedCalls },
+        { "unfinishedCalls", stats.inFlight },
+        { "callsPerSecond", double(completedCalls) / duration },
+        { "methods", methods },
+        { "notifications", QJsonObject {
+            { "changes", loadGenerator.changes() },
+            { "expected", loadGenerator.changes() * clientCount },
+            { "received", receivedNotifications },
+            { "minPerClient", minNotifications },
+            { "maxPerClient", maxNotifications },
+            { "lagUs", latencyStats(stats.notificationLags) },
+        }},
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    qDeleteAll(clients);
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#include "load_daemon.moc"
@@ -0,0 +1,464 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "accounts_db_generator.h"
+#include "benchmark_common.h"
+#include "daemon_interface.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QList>
+#include <QQueue>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <algorithm>
+#include <cstdlib>
+
+/* Replays the calls recorded by accountd when started with OAD_RECORD_CALLS
+ * set, against a daemon running on the mocked bus of the functional tests.
+ *
+ * The recorded accounts, services, applications and security contexts are
+ * just numbers: they are mapped onto a generated accounts DB big enough to
+ * hold all of them.
+ *
+ * Each daemon process which recorded into the file makes a separate session,
+ * with its own numbering of the clients: sessions are replayed one after the
+ * other, each with its own set of clients. */
+
+struct RecordedCall {
+    /* Since the start of the session */
+    qint64 timeMs;
+    int client;
+    QString method;
+    QVariantMap args;
+};
+
+struct RecordedSession {
+    qint64 startMs = 0;
+    QList<RecordedCall> calls;
+    /* The security context of each client: -1 for unconfined */
+    QHash<int,int> clientProfiles;
+};
+
+struct Recording {
+    bool load(const QString &fileName);
+
+    QList<RecordedSession> sessions;
+    int callCount = 0;
+    int clientCount = 0;
+    int accountCount = 0;
+    int serviceCount = 0;
+    int applicationCount = 0;
+};
+
+bool Recording::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Cannot read" << fileName;
+        return false;
+    }
+
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        lineNumber++;
+        if (line.isEmpty()) continue;
+
+        QJsonParseError error;
+        QJsonObject object = QJsonDocument::fromJson(line, &error).object();
+        if (error.error != QJsonParseError::NoError) {
+            qCritical() << "Invalid recording at line" << lineNumber <<
+                error.errorString();
+            return false;
+        }
+
+        if (object.contains("sessionStartMs")) {
+            RecordedSession session;
+            session.startMs =
+                qint64(object.value("sessionStartMs").toDouble());
+            sessions.append(session);
+            continue;
+        }
+
+        if (Q_UNLIKELY(sessions.isEmpty())) {
+            qCritical() << "Call without a session marker at line" <<
+                lineNumber;
+            return false;
+        }
+        RecordedSession &session = sessions.last();
+
+        RecordedCall call;
+        call.timeMs = qint64(object.value("timeMs").toDouble()) -
+            session.startMs;
+        call.client = object.value("client").toInt();
+        call.method = object.value("method").toString();
+        call.args = object.value("args").toObject().toVariantMap();
+        session.calls.append(call);
+        callCount++;
+
+        QJsonValue profile = object.value("profile");
+        int profileId = profile.isString() ? -1 : profile.toInt();
+        session.clientProfiles.insert(call.client, profileId);
+
+        int account = call.args.value("account", -1).toInt();
+        int service = call.args.value("service", -1).toInt();
+        int application = call.args.value("application", -1).toInt();
+        accountCount = qMax(accountCount, account + 1);
+        serviceCount = qMax(serviceCount, service + 1);
+        applicationCount = qMax(applicationCount,
+                                qMax(application, profileId) + 1);
+    }
+
+    for (RecordedSession &session: sessions) {
+        clientCount += session.clientProfiles.count();
+        /* Calls are recorded in order, but let's not depend on it */
+        std::stable_sort(session.calls.begin(), session.calls.end(),
+                         [](const RecordedCall &a, const RecordedCall &b) {
+            return a.timeMs < b.timeMs;
+        });
+    }
+    return true;
+}
+
+struct ReplayStats {
+    QHash<QString,QVector<qint64> > latencies;
+    QHash<QString,int> errors;
+    int pendingCalls = 0;
+};
+
+class ReplayClient: public QObject
+{
+    Q_OBJECT
+
+public:
+    ReplayClient(const QString &busAddress, int index,
+                 const AccountsDbGenerator *generator, ReplayStats *stats,
+                 QObject *parent = 0);
+    ~ReplayClient();
+
+    QString uniqueName() const { return m_connection.baseService(); }
+
+    /* In "fast" mode each client sends its next call as soon as it gets the
+     * reply to the previous one */
+    void enqueue(const RecordedCall &call) { m_queue.enqueue(call); }
+    void startQueue() { if (!m_queue.isEmpty()) makeCall(m_queue.dequeue()); }
+
+    void makeCall(const RecordedCall &call);
+
+Q_SIGNALS:
+    void callFinished();
+
+private Q_SLOTS:
+    void onCallFinished(QDBusPendingCallWatcher *watcher);
+
+private:
+    uint accountId(const QVariantMap &args) const;
+    QString serviceId(const QVariantMap &args) const;
+
+private:
+    QDBusConnection m_connection;
+    DaemonInterface *m_daemon;
+    const AccountsDbGenerator *m_generator;
+    ReplayStats *m_stats;
+    QQueue<RecordedCall> m_queue;
+    QElapsedTimer m_clock;
+};
+
+ReplayClient::ReplayClient(const QString &busAddress, int index,
+                           const AccountsDbGenerator *generator,
+                           ReplayStats *stats, QObject *parent):
+    QObject(parent),
+    m_connection(QDBusConnection::connectToBus(busAddress,
+                                               QString("replay-client-%1").
+                                               arg(index))),
+    m_daemon(new DaemonInterface(m_connection, this)),
+    m_generator(generator),
+    m_stats(stats)
+{
+    m_clock.start();
+}
+
+ReplayClient::~ReplayClient()
+{
+    delete m_daemon;
+    QDBusConnection::disconnectFromBus(m_connection.name());
+}
+
+uint ReplayClient::accountId(const QVariantMap &args) const
+{
+    QList<uint> accountIds = m_generator->accountIds();
+    return accountIds[args.value("account").toInt() % accountIds.count()];
+}
+
+QString ReplayClient::serviceId(const QVariantMap &args) const
+{
+    return AccountsDbGenerator::serviceId(0, args.value("service").toInt());
+}
+
+void ReplayClient::makeCall(const RecordedCall &call)
+{
+    QDBusPendingCall pendingCall;
+    if (call.method == "GetAccounts") {
+        QVariantMap filters;
+        if (call.args.contains("application")) {
+            filters["applicationId"] = AccountsDbGenerator::applicationId(
+                call.args.value("application").toInt());
+        }
+        if (call.args.contains("service")) {
+            filters[ONLINE_ACCOUNTS_INFO_KEY_SERVICE_ID] = serviceId(call.args);
+        }
+        if (call.args.contains("account")) {
+            filters["accountId"] = accountId(call.args);
+        }
+        pendingCall = m_daemon->getAccounts(filters);
+    } else if (call.method == "Authenticate") {
+        pendingCall =
+            m_daemon->authenticate(accountId(call.args), serviceId(call.args),
+                                   call.args.value("interactive").toBool(),
+                                   call.args.value("invalidate").toBool(),
+                                   QVariantMap());
+    } else if (call.method == "RequestAccess") {
+        pendingCall = m_daemon->requestAccess(serviceId(call.args),
+                                              QVariantMap());
+    } else {
+        qWarning() << "Skipping unknown method" << call.method;
+        QMetaObject::invokeMethod(this, "callFinished", Qt::QueuedConnection);
+        startQueue();
+        return;
+    }
+    m_stats->pendingCalls++;
+
+    auto watcher = new QDBusPendingCallWatcher(pendingCall, this);
+    watcher->setProperty("method", call.method);
+    watcher->setProperty("started", m_clock.nsecsElapsed());
+    QObject::connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                     this, SLOT(onCallFinished(QDBusPendingCallWatcher*)));
+}
+
+void ReplayClient::onCallFinished(QDBusPendingCallWatcher *watcher)
+{
+    QString method = watcher->property("method").toString();
+    qint64 started = watcher->property("started").toLongLong();
+    m_stats->latencies[method].append(
+        (m_clock.nsecsElapsed() - started) / 1000);
+    if (watcher->isError()) {
+        m_stats->errors[method]++;
+    }
+    m_stats->pendingCalls--;
+    watcher->deleteLater();
+
+    startQueue();
+    Q_EMIT callFinished();
+}
+
+/* Replays the calls of one session, and returns when all of them have got
+ * their replies */
+static void replaySession(const RecordedSession &session, DBusService *dbus,
+                          const AccountsDbGenerator *generator,
+                          ReplayStats *stats, bool fast, double speed)
+{
+    QHash<int,ReplayClient*> clients;
+    for (auto i = session.clientProfiles.constBegin();
+         i != session.clientProfiles.constEnd(); i++) {
+        auto client = new ReplayClient(dbus->sessionBus(), i.key(),
+                                       generator, stats);
+        QByteArray profile = i.value() < 0 ? QByteArray("unconfined") :
+            (AccountsDbGenerator::applicationId(i.value()) + "_0.1").toUtf8();
+        dbus->dbusApparmor().setCredentials(client->uniqueName(), {
+            { "LinuxSecurityLabel", profile },
+        });
+        clients.insert(i.key(), client);
+    }
+
+    QEventLoop loop;
+    int remainingCalls = session.calls.count();
+    Q_FOREACH(ReplayClient *client, clients) {
+        QObject::connect(client, &ReplayClient::callFinished,
+                         &loop, [&remainingCalls, &loop]() {
+            if (--remainingCalls == 0) loop.quit();
+        });
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QTimer scheduler;
+    if (fast) {
+        Q_FOREACH(const RecordedCall &call, session.calls) {
+            clients[call.client]->enqueue(call);
+        }
+        Q_FOREACH(ReplayClient *client, clients) {
+            client->startQueue();
+        }
+    } else {
+        /* Send all the calls which are due, then sleep until the next one */
+        int next = 0;
+        scheduler.setSingleShot(true);
+        QObject::connect(&scheduler, &QTimer::timeout, [&]() {
+            qint64 now = timer.elapsed();
+            while (next < session.calls.count() &&
+                   session.calls[next].timeMs / speed <= now) {
+                const RecordedCall &call = session.calls[next++];
+                clients[call.client]->makeCall(call);
+            }
+            if (next < session.calls.count()) {
+                scheduler.start(int(session.calls[next].timeMs / speed -
+                                    now));
+            }
+        });
+        scheduler.start(int(session.calls.first().timeMs / speed));
+    }
+    loop.exec();
+
+    qDeleteAll(clients);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Replays a recording of the calls made to accountd");
+    parser.addHelpOption();
+    parser.addPositionalArgument("recording",
+                                 "File written by accountd, when started "
+                                 "with OAD_RECORD_CALLS set");
+    QCommandLineOption fastOption("fast",
+        "Don't wait between calls, only keep the order of each client");
+    QCommandLineOption speedOption("speed",
+        "Speed factor for the original timing", "factor", "1");
+    QCommandLineOption accountsOption("accounts",
+        "Minimum number of accounts in the generated DB", "count", "10");
+    QCommandLineOption jsonOption("json",
+        "Write the JSON results to this file instead of stdout", "file");
+    parser.addOption(fastOption);
+    parser.addOption(speedOption);
+    parser.addOption(accountsOption);
+    parser.addOption(jsonOption);
+    parser.process(app);
+
+    double speed = parser.value(speedOption).toDouble();
+    if (parser.positionalArguments().count() != 1 || speed <= 0) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    QString recordingFile = parser.positionalArguments().first();
+    Recording recording;
+    if (!recording.load(recordingFile)) {
+        return EXIT_FAILURE;
+    }
+    if (recording.callCount == 0) {
+        qCritical() << "No calls in" << recordingFile;
+        return EXIT_FAILURE;
+    }
+
+    QTemporaryDir dataDir;
+    qputenv("XDG_DATA_HOME", TEST_DATA_DIR);
+    qputenv("XDG_CACHE_HOME", dataDir.path().toUtf8());
+    qputenv("SSO_USE_PEER_BUS", "0");
+    qputenv("OAD_TIMEOUT", "300");
+    qputenv("OAD_TESTING", "1");
+
+    AccountsDbGenerator generator(dataDir.path());
+    generator.setAccountCount(qMax(recording.accountCount,
+                                   parser.value(accountsOption).toInt()));
+    generator.setServicesPerAccount(qMax(recording.serviceCount, 1));
+    generator.setApplicationCount(qMax(recording.applicationCount, 1));
+    if (!generator.generate() || generator.accountIds().isEmpty()) {
+        return EXIT_FAILURE;
+    }
+
+    DBusService dbus;
+    dbus.startServices();
+    dbus.signond().addIdentity(generator.credentialsId(), QVariantMap());
+    dbus.onlineAccounts().setRequestAccessReply({
+        { "accountId", generator.accountIds().first() },
+    });
+
+    /* The time between sessions, when the daemon was not running, is not
+     * replayed */
+    ReplayStats stats;
+    qint64 recordedDurationMs = 0;
+    QElapsedTimer timer;
+    timer.start();
+    Q_FOREACH(const RecordedSession &session, recording.sessions) {
+        if (session.calls.isEmpty()) continue;
+        replaySession(session, &dbus, &generator, &stats,
+                      parser.isSet(fastOption), speed);
+        recordedDurationMs +=
+            session.calls.last().timeMs - session.calls.first().timeMs;
+    }
+    qint64 elapsedMs = timer.elapsed();
+
+    QJsonObject methods;
+    int errors = 0;
+    for (auto i = stats.latencies.constBegin();
+         i != stats.latencies.constEnd(); i++) {
+        errors += stats.errors.value(i.key());
+        methods.insert(i.key(), QJsonObject {
+            { "calls", i.value().count() },
+            { "errors", stats.errors.value(i.key()) },
+            { "latencyUs", latencyStats(i.value()) },
+        });
+    }
+
+    QJsonObject report {
+        { "benchmark", "replay_daemon" },
+        { "recording", recordingFile },
+        { "mode", parser.isSet(fastOption) ? "fast" : "original" },
+        { "sessions", recording.sessions.count() },
+        { "clients", recording.clientCount },
+        { "calls", recording.callCount },
+        { "errors", errors },
+        { "recordedDurationMs", recordedDurationMs },
+        { "durationMs", elapsedMs },
+        { "callsPerSecond", elapsedMs > 0 ?
+            recording.callCount * 1000.0 / elapsedMs : 0.0 },
+        { "methods", methods },
+    };
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(jsonOption)) {
+        QFile file(parser.value(jsonOption));
+        if (!file.open(QIODevice::WriteOnly)) {
+            qCritical() << "Cannot write" << file.fileName();
+            return EXIT_FAILURE;
+        }
+        file.write(json);
+    } else {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#include "replay_daemon.moc"
@@ -20,9 +20,25 @@
 
 #include "daemon_interface.h"
 
+#include <QDBusMessage>
 #include <QDBusMetaType>
 #include <climits>
 
+namespace {
+
+QVariant expandArgument(const QVariant &value)
+{
+    if (value.userType() != qMetaTypeId<QDBusArgument>()) return value;
+
+    QVariantMap map = qdbus_cast<QVariantMap>(value.value<QDBusArgument>());
+    for (auto i = map.begin(); i != map.end(); i++) {
+        i.value() = expandArgument(i.value());
+    }
+    return map;
+}
+
+} // namespace
+
 QDBusArgument &operator<<(QDBusArgument &argument, const AccountInfo &info) {
     argument.beginStructure();
     argument << info.accountId << info.details;
@@ -56,3 +72,20 @@ DaemonInterface::DaemonInterface(const QDBusConnection &connection, QObject *par
         qCritical() << "Connection to AccountChanged signal failed";
     }
 }
+
+QVariant callDebugMethod(const QDBusConnection &connection,
+                         const QString &method)
+{
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                       ONLINE_ACCOUNTS_MANAGER_PATH,
+                                       ONLINE_ACCOUNTS_DEBUG_INTERFACE,
+                                       method);
+    QDBusMessage reply = connection.call(msg);
+    if (Q_UNLIKELY(reply.type() != QDBusMessage::ReplyMessage ||
+                   reply.arguments().isEmpty())) {
+        qWarning() << method << "failed:" << reply.errorMessage();
+        return QVariant();
+    }
+    return expandArgument(reply.arguments().first());
+}
@@ -30,6 +30,7 @@
 #include <QDBusPendingReply>
 #include <QDebug>
 #include <QList>
+#include <QVariant>
 #include <QVariantMap>
 
 class AccountInfo {
@@ -94,4 +95,9 @@ private:
     }
 };
 
+/* Calls a method of the daemon's debug interface; D-Bus dictionaries nested
+ * in the result are unmarshalled too. The result is invalid on errors. */
+QVariant callDebugMethod(const QDBusConnection &connection,
+                         const QString &method);
+
 #endif // OAD_DAEMON_INTERFACE_H
@@ -0,0 +1,54 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OAD_DBUS_SERVICE_H
+#define OAD_DBUS_SERVICE_H
+
+#include "fake_dbus_apparmor.h"
+#include "fake_online_accounts_service.h"
+#include "fake_signond.h"
+#include <libqtdbusmock/DBusMock.h>
+
+/* Private session bus, with the services used by the daemon mocked; shared
+ * by the functional tests and the benchmarks */
+class DBusService: public QtDBusTest::DBusTestRunner
+{
+public:
+    DBusService():
+        QtDBusTest::DBusTestRunner(TEST_DBUS_CONFIG_FILE),
+        m_mock(*this),
+        m_dbusApparmor(&m_mock),
+        m_onlineAccounts(&m_mock),
+        m_signond(&m_mock)
+    {
+    }
+
+    FakeDBusApparmor &dbusApparmor() { return m_dbusApparmor; }
+    FakeOnlineAccountsService &onlineAccounts() { return m_onlineAccounts; }
+    FakeSignond &signond() { return m_signond; }
+
+private:
+    QtDBusMock::DBusMock m_mock;
+    FakeDBusApparmor m_dbusApparmor;
+    FakeOnlineAccountsService m_onlineAccounts;
+    FakeSignond m_signond;
+};
+
+#endif // OAD_DBUS_SERVICE_H
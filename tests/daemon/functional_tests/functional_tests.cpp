@@ -20,22 +20,28 @@
 
 #include "OnlineAccountsDaemon/dbus_constants.h"
 #include "daemon_interface.h"
-#include "fake_dbus_apparmor.h"
-#include "fake_online_accounts_service.h"
-#include "fake_signond.h"
+#include "dbus_service.h"
 #include <Accounts/Account>
 #include <Accounts/Manager>
 #include <Accounts/Service>
 #include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusMessage>
+#include <QDBusReply>
 #include <QDBusServiceWatcher>
 #include <QDir>
+#include <QFile>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QObject>
 #include <QProcess>
+#include <QSet>
 #include <QSignalSpy>
+#include <QTemporaryDir>
 #include <QTest>
 #include <libqtdbusmock/DBusMock.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -173,31 +179,6 @@ private:
     bool m_replyExpected;
 };
 
-class DBusService: public QtDBusTest::DBusTestRunner
-{
-public:
-    DBusService();
-
-    FakeDBusApparmor &dbusApparmor() { return m_dbusApparmor; }
-    FakeOnlineAccountsService &onlineAccounts() { return m_onlineAccounts; }
-    FakeSignond &signond() { return m_signond; }
-
-private:
-    QtDBusMock::DBusMock m_mock;
-    FakeDBusApparmor m_dbusApparmor;
-    FakeOnlineAccountsService m_onlineAccounts;
-    FakeSignond m_signond;
-};
-
-DBusService::DBusService():
-    QtDBusTest::DBusTestRunner(TEST_DBUS_CONFIG_FILE),
-    m_mock(*this),
-    m_dbusApparmor(&m_mock),
-    m_onlineAccounts(&m_mock),
-    m_signond(&m_mock)
-{
-}
-
 class FunctionalTests: public QObject
 {
     Q_OBJECT
@@ -218,14 +199,41 @@ private Q_SLOTS:
     void testAuthenticate();
     void testRequestAccess_data();
     void testRequestAccess();
+    void testRequestAccessOtherPackage();
+    void testAccessPolicy_data();
+    void testAccessPolicy();
+    void testCatalogDirectoryCreated();
     void testAccountChanges();
     void testLifetime();
+    void testStartupTimings();
+    void testStatistics();
+    void testClientEviction();
+    void testCallsIdleChanges();
+    void testTrace();
+    void testHeapUsage();
+    void testStateRoundTrip();
+    void testStateInvalid_data();
+    void testStateInvalid();
+    void testStateUnchanged();
+    void testLegacyStateMigrated();
+    void testRepliesSnapshot();
+    void testIncrementalLoading();
+    void testClientUsage();
+    void testClientUnregistered();
+    void testQuotas();
 
 private:
     void clearDb();
+    QMap<QByteArray,QByteArray> testEnvironment(const QString &test) const;
+    QString stateFile() const;
+    bool waitForDaemonExit();
+    QVariantMap managerStatistics();
 
 private:
     EnvSetup m_env;
+    /* Recreated for each test, so that failed tests leave nothing behind */
+    QTemporaryDir *m_tmpDir;
+    QMap<QByteArray,QByteArray> m_savedEnvironment;
     DBusService *m_dbus;
     int m_firstAccountId;
     int m_account2CredentialsId;
@@ -248,6 +256,7 @@ FunctionalTests::EnvSetup::EnvSetup() {
 
 FunctionalTests::FunctionalTests():
     QObject(),
+    m_tmpDir(0),
     m_dbus(0),
     m_account2CredentialsId(41),
     m_account3CredentialsId(35)
@@ -303,8 +312,111 @@ void FunctionalTests::clearDb()
     dbroot.remove("accounts.db");
 }
 
+/* Variables to be set while running the given test; the accounts daemon
+ * inherits them from the D-Bus daemon, which is restarted for every test */
+QMap<QByteArray,QByteArray>
+FunctionalTests::testEnvironment(const QString &test) const
+{
+    QMap<QByteArray,QByteArray> environment;
+
+    /* The other tests run the daemon in its default configuration */
+    static const QStringList debugTests {
+        "testCatalogDirectoryCreated",
+        "testStartupTimings",
+        "testStatistics",
+        "testClientEviction",
+        "testCallsIdleChanges",
+        "testTrace",
+        "testHeapUsage",
+        "testStateRoundTrip",
+        "testStateInvalid",
+        "testStateUnchanged",
+        "testLegacyStateMigrated",
+        "testRepliesSnapshot",
+        "testIncrementalLoading",
+        "testClientUsage",
+        "testClientUnregistered",
+        "testQuotas",
+    };
+    if (debugTests.contains(test)) {
+        environment["OAD_DEBUG_INTERFACE"] = "1";
+    }
+    if (test == "testHeapUsage") {
+        environment["OAD_HEAP_ACCOUNTING"] = "1";
+    }
+
+    if (test == "testLifetime") {
+        /* A low timeout, to make the test meaningful */
+        environment["OAD_TIMEOUT"] = "2";
+    } else if (test == "testCatalogDirectoryCreated") {
+        environment["AG_SERVICES"] = (m_tmpDir->path() + "/services").toUtf8();
+    } else if (test == "testStateRoundTrip" || test == "testStateInvalid") {
+        /* Let the daemon exit soon, to test its restart */
+        environment["OAD_TIMEOUT"] = "1";
+        environment["XDG_CACHE_HOME"] = (m_tmpDir->path() + "/cache").toUtf8();
+    } else if (test == "testIncrementalLoading") {
+        /* Use a separate accounts DB, with many accounts */
+        environment["OAD_TIMEOUT"] = "1";
+        environment["XDG_CACHE_HOME"] = (m_tmpDir->path() + "/cache").toUtf8();
+        environment["ACCOUNTS"] = (m_tmpDir->path() + "/accounts").toUtf8();
+    } else if (test == "testRepliesSnapshot") {
+        environment["OAD_TIMEOUT"] = "1";
+        environment["XDG_CACHE_HOME"] = (m_tmpDir->path() + "/cache").toUtf8();
+        environment["AG_APPLICATIONS"] =
+            (m_tmpDir->path() + "/applications").toUtf8();
+    } else if (test == "testStateUnchanged" ||
+               test == "testLegacyStateMigrated") {
+        environment["XDG_CACHE_HOME"] = (m_tmpDir->path() + "/cache").toUtf8();
+    } else if (test == "testRequestAccessOtherPackage") {
+        environment["AG_APPLICATIONS"] =
+            (m_tmpDir->path() + "/applications").toUtf8();
+    } else if (test == "testQuotas") {
+        environment["OAD_QUOTA_CALLS_PER_MINUTE"] = "2";
+    }
+    return environment;
+}
+
+QString FunctionalTests::stateFile() const
+{
+    return m_tmpDir->path() + "/cache/accountd/client_account_refs.bin";
+}
+
+bool FunctionalTests::waitForDaemonExit()
+{
+    QDBusServiceWatcher watcher(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                m_dbus->sessionConnection(),
+                                QDBusServiceWatcher::WatchForUnregistration);
+    QSignalSpy unregistered(&watcher,
+                            SIGNAL(serviceUnregistered(const QString &)));
+    QDBusReply<bool> isRegistered =
+        m_dbus->sessionConnection().interface()->
+        isServiceRegistered(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME);
+    if (!isRegistered.value()) return true;
+    return unregistered.wait(10000);
+}
+
+QVariantMap FunctionalTests::managerStatistics()
+{
+    QVariantMap statistics =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetStatistics").toMap();
+    return statistics["manager"].toMap();
+}
+
 void FunctionalTests::init()
 {
+    m_tmpDir = new QTemporaryDir;
+    QVERIFY(m_tmpDir->isValid());
+
+    QMap<QByteArray,QByteArray> environment =
+        testEnvironment(QTest::currentTestFunction());
+    for (auto i = environment.constBegin(); i != environment.constEnd(); i++) {
+        /* A null value means that the variable was not set */
+        m_savedEnvironment.insert(i.key(), qEnvironmentVariableIsSet(i.key()) ?
+                                  qgetenv(i.key()) : QByteArray());
+        qputenv(i.key(), i.value());
+    }
+
     m_dbus = new DBusService();
     m_dbus->startServices();
 
@@ -315,6 +427,19 @@ void FunctionalTests::init()
 void FunctionalTests::cleanup()
 {
     delete m_dbus;
+    delete m_tmpDir;
+    m_tmpDir = 0;
+
+    /* Restore the environment, even if the test failed */
+    for (auto i = m_savedEnvironment.constBegin();
+         i != m_savedEnvironment.constEnd(); i++) {
+        if (i.value().isNull()) {
+            qunsetenv(i.key());
+        } else {
+            qputenv(i.key(), i.value());
+        }
+    }
+    m_savedEnvironment.clear();
 }
 
 
@@ -693,6 +818,145 @@ void FunctionalTests::testRequestAccess()
     delete daemon;
 }
 
+void FunctionalTests::testRequestAccessOtherPackage()
+{
+    /* The only application using the service belongs to a different package
+     * than the client's: the client must not be able to request access on
+     * its behalf. */
+    QString applicationsDir = m_tmpDir->path() + "/applications";
+    QVERIFY(QDir().mkpath(applicationsDir));
+    QFile file(applicationsDir + "/com.ubuntu.othertests_sharer.application");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+               "<application id=\"com.ubuntu.othertests_sharer\">\n"
+               "  <services>\n"
+               "    <service id=\"com.ubuntu.tests_coolshare\"/>\n"
+               "  </services>\n"
+               "</application>\n");
+    file.close();
+
+    QVariantMap accessReply;
+    accessReply["accountId"] = m_firstAccountId + 2;
+    m_dbus->onlineAccounts().setRequestAccessReply(accessReply);
+    m_dbus->signond().addIdentity(m_account2CredentialsId, QVariantMap());
+    m_dbus->dbusApparmor().setCredentials(
+        m_dbus->sessionConnection().baseService(), {
+            { "LinuxSecurityLabel",
+              QByteArray("com.ubuntu.tests_application_0.2") },
+        });
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+
+    QDBusPendingReply<AccountInfo,QVariantMap> reply =
+        daemon->requestAccess("com.ubuntu.tests_coolshare", QVariantMap());
+    reply.waitForFinished();
+
+    QVERIFY(reply.isError());
+    QCOMPARE(reply.error().name(),
+             QString(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED));
+
+    delete daemon;
+}
+
+void FunctionalTests::testAccessPolicy_data()
+{
+    QTest::addColumn<QString>("serviceId");
+    QTest::addColumn<QString>("errorName");
+
+    QTest::newRow("service of own package") <<
+        "com.ubuntu.tests_coolshare" <<
+        QString();
+
+    QTest::newRow("service of own package, not installed") <<
+        "com.ubuntu.tests_uninstalled" <<
+        ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED;
+
+    QTest::newRow("service of another package") <<
+        "coolmail" <<
+        ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED;
+}
+
+void FunctionalTests::testAccessPolicy()
+{
+    QFETCH(QString, serviceId);
+    QFETCH(QString, errorName);
+
+    m_dbus->signond().addIdentity(m_account2CredentialsId, QVariantMap());
+    m_dbus->dbusApparmor().setCredentials(
+        m_dbus->sessionConnection().baseService(), {
+            { "LinuxSecurityLabel",
+              QByteArray("com.ubuntu.tests_application_0.2") },
+        });
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+
+    /* Twice: the second time, the precomputed policy is used */
+    for (int i = 0; i < 2; i++) {
+        QDBusPendingReply<QVariantMap> reply =
+            daemon->authenticate(m_firstAccountId + 2, serviceId,
+                                 false, false, QVariantMap());
+        reply.waitForFinished();
+        if (errorName.isEmpty()) {
+            QVERIFY2(!reply.isError(),
+                     reply.error().message().toUtf8().constData());
+        } else {
+            QVERIFY(reply.isError());
+            QCOMPARE(reply.error().name(), errorName);
+        }
+    }
+
+    delete daemon;
+}
+
+void FunctionalTests::testCatalogDirectoryCreated()
+{
+    /* AG_SERVICES points to a directory which doesn't exist yet: the daemon
+     * must notice when it gets created and populated */
+    QString servicesDir = m_tmpDir->path() + "/services";
+    QVERIFY(!QDir(servicesDir).exists());
+
+    m_dbus->signond().addIdentity(m_account2CredentialsId, QVariantMap());
+    m_dbus->dbusApparmor().setCredentials(
+        m_dbus->sessionConnection().baseService(), {
+            { "LinuxSecurityLabel",
+              QByteArray("com.ubuntu.tests_application_0.2") },
+        });
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    auto authenticate = [&]() {
+        QDBusPendingReply<QVariantMap> reply =
+            daemon->authenticate(m_firstAccountId + 2,
+                                 "com.ubuntu.tests_coolshare",
+                                 false, false, QVariantMap());
+        reply.waitForFinished();
+        return reply.isError() ? reply.error().name() : QString();
+    };
+
+    QCOMPARE(authenticate(), QString(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED));
+
+    /* Other changes in the parent directory don't affect the catalog */
+    auto allowedServicesCache = [this]() {
+        QVariantMap statistics =
+            callDebugMethod(m_dbus->sessionConnection(),
+                            "GetStatistics").toMap();
+        return statistics["caches"].toMap()["allowedServices"].toMap();
+    };
+    QFile unrelatedFile(m_tmpDir->path() + "/unrelated");
+    QVERIFY(unrelatedFile.open(QIODevice::WriteOnly));
+    unrelatedFile.close();
+    QTest::qWait(200);
+    QCOMPARE(authenticate(), QString(ONLINE_ACCOUNTS_ERROR_PERMISSION_DENIED));
+    QCOMPARE(allowedServicesCache()["hits"].toUInt(), 1U);
+
+    QVERIFY(QDir().mkpath(servicesDir));
+    QVERIFY(QFile::copy(TEST_DATA_DIR "/com.ubuntu.tests_coolshare.service",
+                        servicesDir + "/com.ubuntu.tests_coolshare.service"));
+
+    QTRY_COMPARE(authenticate(), QString());
+
+    delete daemon;
+}
+
 void FunctionalTests::testAccountChanges()
 {
     DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
@@ -788,16 +1052,9 @@ void FunctionalTests::testAccountChanges()
 
 void FunctionalTests::testLifetime()
 {
-    /* Destroy the D-Bus daemon, and create one with the OAD_TIMEOUT variable
-     * set to a lower value, to make this test meaningful */
-    delete m_dbus;
-
-    qputenv("OAD_TIMEOUT", "2");
-
-    m_dbus = new DBusService();
-    m_dbus->startServices();
-
-    /* Make a dbus call, and have signond reply after 3 seconds; make sure that
+    /* OAD_TIMEOUT is set to 2 seconds by testEnvironment().
+     *
+     * Make a dbus call, and have signond reply after 3 seconds; make sure that
      * the online accounts daemon doesn't time out. */
     m_dbus->signond().addIdentity(m_account3CredentialsId, QVariantMap());
 
@@ -829,7 +1086,647 @@ void FunctionalTests::testLifetime()
     delete daemon;
 
     /* We expect the OA service to exit within a couple of seconds */
-    unregistered.wait();
+    QTRY_COMPARE(unregistered.count(), 1);
+}
+
+void FunctionalTests::testStartupTimings()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+
+    QVariantMap timings =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetStartupTimings").toMap();
+    QVERIFY(!timings.isEmpty());
+    QVERIFY(timings.contains("main"));
+    QVERIFY(timings.contains("busRegistered"));
+    QVERIFY(timings.contains("firstReply"));
+    QVERIFY(timings["main"].toLongLong() <=
+            timings["busRegistered"].toLongLong());
+    QVERIFY(timings["busRegistered"].toLongLong() <=
+            timings["firstReply"].toLongLong());
+
+    delete daemon;
+}
+
+void FunctionalTests::testStatistics()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QVariantMap filters;
+    filters["applicationId"] = "com.ubuntu.tests_application";
+    for (int i = 0; i < 2; i++) {
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon->getAccounts(filters);
+        call.waitForFinished();
+        QVERIFY(!call.isError());
+    }
+
+    QVariantMap statistics =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetStatistics").toMap();
+    QVERIFY(!statistics.isEmpty());
+    QVariantMap methods = statistics["methods"].toMap();
+    QVariantMap getAccounts = methods["GetAccounts"].toMap();
+    QCOMPARE(getAccounts["calls"].toUInt(), 2U);
+    QCOMPARE(getAccounts["errors"].toUInt(), 0U);
+
+    QVariantMap clients = statistics["clients"].toMap();
+    QCOMPARE(clients.value(m_dbus->sessionConnection().baseService()).toUInt(),
+             2U);
+
+    delete daemon;
+}
+
+void FunctionalTests::testClientEviction()
+{
+    QString connectionName;
+    QString busName;
+    {
+        QDBusConnection connection =
+            QDBusConnection::connectToBus(m_dbus->sessionBus(), "client");
+        QVERIFY(connection.isConnected());
+        connectionName = connection.name();
+        busName = connection.baseService();
+        DaemonInterface daemon(connection);
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon.getAccounts(QVariantMap());
+        call.waitForFinished();
+        QVERIFY(!call.isError());
+        QVERIFY(!call.argumentAt<0>().isEmpty());
+    }
+
+    QVariantMap statistics = managerStatistics();
+    int activeAccounts = statistics["activeAccounts"].toInt();
+    int watchedAccounts = statistics["watchedAccounts"].toInt();
+    QVERIFY(activeAccounts > 0);
+    QVERIFY(watchedAccounts > 0);
+    QCOMPARE(statistics["activeAccountsPeak"].toInt(), activeAccounts);
+    QCOMPARE(statistics["watchedAccountsPeak"].toInt(), watchedAccounts);
+
+    /* Once the client is gone, its accounts must be released */
+    QDBusConnection::disconnectFromBus(connectionName);
+    QTRY_COMPARE(managerStatistics()["activeAccounts"].toInt(), 0);
+
+    statistics = managerStatistics();
+    QCOMPARE(statistics["watchedAccounts"].toInt(), 0);
+    QCOMPARE(statistics["clients"].toInt(), 0);
+    QCOMPARE(statistics["activeAccountsPeak"].toInt(), activeAccounts);
+    QCOMPARE(statistics["watchedAccountsPeak"].toInt(), watchedAccounts);
+
+    /* The per-client call counts are dropped too */
+    QVariantMap callStatistics =
+        callDebugMethod(m_dbus->sessionConnection(), "GetStatistics").toMap();
+    QVERIFY(!callStatistics["clients"].toMap().contains(busName));
+}
+
+void FunctionalTests::testCallsIdleChanges()
+{
+    m_dbus->signond().addIdentity(m_account3CredentialsId, QVariantMap());
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+
+    /* Activate the daemon and let it finish loading */
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+    QTRY_COMPARE(managerStatistics()["activeCalls"].toInt(), 0);
+    uint changes = managerStatistics()["callsIdleChanges"].toUInt();
+
+    /* Overlapping calls: the daemon becomes busy once, and idle once */
+    QVariantMap authParams;
+    authParams["delay"] = 2;
+    QList<QDBusPendingCall> calls;
+    calls.append(daemon->authenticate(m_firstAccountId + 3, "coolmail",
+                                      false, false, authParams));
+    authParams["delay"] = 1;
+    calls.append(daemon->authenticate(m_firstAccountId + 3, "coolmail",
+                                      false, false, authParams));
+    for (int i = 0; i < 3; i++) {
+        calls.append(daemon->getAccounts(QVariantMap()));
+    }
+    QTRY_COMPARE(managerStatistics()["activeCalls"].toInt(), 2);
+    QCOMPARE(managerStatistics()["callsIdleChanges"].toUInt(), changes + 1);
+
+    Q_FOREACH(QDBusPendingCall pendingCall, calls) {
+        pendingCall.waitForFinished();
+        QVERIFY(!pendingCall.isError());
+    }
+    QTRY_COMPARE(managerStatistics()["activeCalls"].toInt(), 0);
+    QCOMPARE(managerStatistics()["callsIdleChanges"].toUInt(), changes + 2);
+
+    /* Then a call on its own */
+    call = daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+    QTRY_COMPARE(managerStatistics()["callsIdleChanges"].toUInt(),
+                 changes + 4);
+
+    delete daemon;
+}
+
+void FunctionalTests::testTrace()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QVariantMap filters;
+    filters["applicationId"] = "com.ubuntu.tests_application";
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(filters);
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+
+    QVariant trace = callDebugMethod(m_dbus->sessionConnection(), "GetTrace");
+    QVERIFY(trace.isValid());
+
+    QJsonDocument doc = QJsonDocument::fromJson(trace.toString().toUtf8());
+    QVERIFY(doc.isObject());
+
+    /* All the events of the GetAccounts call must share its trace ID */
+    QMap<int,QStringList> eventsByTrace;
+    Q_FOREACH(const QJsonValue &value,
+              doc.object().value("traceEvents").toArray()) {
+        QJsonObject event = value.toObject();
+        QJsonObject args = event.value("args").toObject();
+        if (args.value("method").toString() != "GetAccounts") continue;
+        eventsByTrace[args.value("traceId").toInt()].append(
+            event.value("name").toString());
+    }
+    QVERIFY(!eventsByTrace.isEmpty());
+    QStringList lastCall = eventsByTrace.value(eventsByTrace.keys().last());
+    QCOMPARE(lastCall.first(), QString("received"));
+    QCOMPARE(lastCall.last(), QString("replySent"));
+
+    delete daemon;
+}
+
+void FunctionalTests::testHeapUsage()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QVariantMap filters;
+    filters["applicationId"] = "com.ubuntu.tests_application";
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(filters);
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+
+    QVariantMap heapUsage =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetHeapUsage").toMap();
+    QVERIFY(!heapUsage.isEmpty());
+    QCOMPARE(heapUsage["enabled"].toBool(), true);
+    QVERIFY(heapUsage["heapBytes"].toLongLong() > 0);
+
+    QVariantMap subsystems = heapUsage["subsystems"].toMap();
+    QStringList expectedSubsystems {
+        "ClientRegistry", "ManagerPrivate", "StateSaver", "libaccounts",
+    };
+    QCOMPARE(subsystems.keys(), expectedSubsystems);
+    /* The GetAccounts call registered a client and loaded some accounts */
+    QVERIFY(subsystems["ClientRegistry"].toLongLong() > 0);
+    QVERIFY(subsystems["libaccounts"].toLongLong() > 0);
+
+    delete daemon;
+}
+
+void FunctionalTests::testStateRoundTrip()
+{
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+    QVariantMap statistics = managerStatistics();
+    int activeAccounts = statistics["activeAccounts"].toInt();
+    QVERIFY(activeAccounts > 0);
+    QCOMPARE(statistics["activations"].toInt(), 1);
+
+    /* The state is written when the daemon exits... */
+    QVERIFY(waitForDaemonExit());
+    QVERIFY(QFile::exists(stateFile()));
+
+    /* ...and read back when it's activated again: our client is still
+     * connected, so its accounts must be restored. */
+    QTRY_COMPARE(managerStatistics()["activeAccounts"].toInt(), activeAccounts);
+    statistics = managerStatistics();
+    QCOMPARE(statistics["activations"].toInt(), 2);
+    QCOMPARE(statistics["idleExits"].toInt(), 1);
+    QCOMPARE(statistics["clients"].toInt(), 1);
+
+    delete daemon;
+}
+
+void FunctionalTests::testStateInvalid_data()
+{
+    QTest::addColumn<QString>("corruption");
+
+    QTest::newRow("wrong magic") << "magic";
+    QTest::newRow("unknown version") << "version";
+    QTest::newRow("truncated") << "truncate";
+}
+
+void FunctionalTests::testStateInvalid()
+{
+    QFETCH(QString, corruption);
+
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+    QVERIFY(waitForDaemonExit());
+
+    QFile file(stateFile());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QByteArray data = file.readAll();
+    QVERIFY(data.size() > 8);
+    /* The header consists of the magic number and the format version, both
+     * big endian 32-bit integers */
+    if (corruption == "magic") {
+        data[0] = char(data[0] ^ 0xff);
+    } else if (corruption == "version") {
+        data[7] = char(data[7] + 1);
+    } else {
+        data.truncate(data.size() / 2);
+    }
+    QVERIFY(file.resize(0));
+    QVERIFY(file.seek(0));
+    QCOMPARE(file.write(data), qint64(data.size()));
+    file.close();
+
+    /* The file must be ignored: this is seen as the first activation */
+    QVariantMap statistics = managerStatistics();
+    QCOMPARE(statistics["activations"].toInt(), 1);
+    QCOMPARE(statistics["idleExits"].toInt(), 0);
+    QCOMPARE(statistics["activeAccounts"].toInt(), 0);
+
+    delete daemon;
+}
+
+void FunctionalTests::testStateUnchanged()
+{
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(!call.isError());
+
+    Accounts::Manager *manager = new Accounts::Manager(this);
+    Accounts::Account *account = manager->account(m_firstAccountId + 3);
+    QVERIFY(account != 0);
+    QString displayName = account->displayName();
+
+    /* Change an account and revert the change: the daemon will save its
+     * state again, but since it's unchanged the file must not be rewritten.
+     * The first round makes the state stable (the cached replies are
+     * dropped on account changes) */
+    struct stat before;
+    for (int round = 0; round < 2; round++) {
+        int stateSaves = managerStatistics()["stateSaves"].toInt();
+        account->setDisplayName("Changed");
+        account->syncAndBlock();
+        account->setDisplayName(displayName);
+        account->syncAndBlock();
+        /* Wait for the save delay to expire */
+        QTRY_VERIFY(managerStatistics()["stateSaves"].toInt() > stateSaves);
+        if (round == 0) {
+            QCOMPARE(stat(QFile::encodeName(stateFile()).constData(),
+                          &before), 0);
+        }
+    }
+
+    struct stat after;
+    QCOMPARE(stat(QFile::encodeName(stateFile()).constData(), &after), 0);
+    QCOMPARE(after.st_ino, before.st_ino);
+    QCOMPARE(after.st_mtim.tv_sec, before.st_mtim.tv_sec);
+    QCOMPARE(after.st_mtim.tv_nsec, before.st_mtim.tv_nsec);
+
+    delete manager;
+    delete daemon;
+}
+
+void FunctionalTests::testLegacyStateMigrated()
+{
+    QString cacheDir = m_tmpDir->path() + "/cache/accountd";
+    QVERIFY(QDir().mkpath(cacheDir));
+    QFile legacyFile(cacheDir + "/client_account_refs.json");
+    QVERIFY(legacyFile.open(QIODevice::WriteOnly));
+    QJsonObject client {
+        { "busName", m_dbus->sessionConnection().baseService() },
+        { "applicationId", "com.ubuntu.tests_application" },
+    };
+    QJsonObject legacyState {
+        { "accounts", QJsonValue() },
+        { "clients", QJsonArray { client } },
+    };
+    legacyFile.write(QJsonDocument(legacyState).toJson());
+    legacyFile.close();
+
+    /* Any call will activate the daemon, which converts the old state and
+     * removes its file */
+    QVERIFY(managerStatistics().contains("activations"));
+    QVERIFY(!legacyFile.exists());
+    QVERIFY(QFile::exists(stateFile()));
+
+    /* Our client is still connected, so it's restored */
+    QTRY_COMPARE(managerStatistics()["clients"].toInt(), 1);
+}
+
+void FunctionalTests::testRepliesSnapshot()
+{
+    QString applicationsDir = m_tmpDir->path() + "/applications";
+    QVERIFY(QDir().mkpath(applicationsDir));
+    QVERIFY(QFile::copy(TEST_DATA_DIR "/com.ubuntu.tests_application.application",
+                        applicationsDir +
+                        "/com.ubuntu.tests_application.application"));
+
+    auto repliesCache = [this]() {
+        QVariantMap statistics =
+            callDebugMethod(m_dbus->sessionConnection(),
+                            "GetStatistics").toMap();
+        return statistics["caches"].toMap()["accountsReplies"].toMap();
+    };
+
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QVariantMap filters;
+    filters["applicationId"] = "com.ubuntu.tests_application";
+    auto getAccounts = [&]() {
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon->getAccounts(filters);
+        call.waitForFinished();
+        return call;
+    };
+
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        getAccounts();
+    QVERIFY(!call.isError());
+    QList<AccountInfo> accounts = call.argumentAt<0>();
+    QList<QVariantMap> services = call.argumentAt<1>();
+    QVERIFY(!accounts.isEmpty());
+
+    /* After a restart, the same reply is served from the saved snapshot */
+    QVERIFY(waitForDaemonExit());
+    call = getAccounts();
+    QVERIFY(!call.isError());
+    QCOMPARE(call.argumentAt<0>().count(), accounts.count());
+    QCOMPARE(call.argumentAt<1>(), services);
+    QVariantMap cacheStats = repliesCache();
+    QCOMPARE(cacheStats["hits"].toUInt(), 1U);
+    QCOMPARE(cacheStats["misses"].toUInt(), 0U);
+
+    /* Change an account while the daemon is not running */
+    QVERIFY(waitForDaemonExit());
+    Accounts::Manager *manager = new Accounts::Manager(this);
+    Accounts::Account *account = manager->account(m_firstAccountId + 2);
+    QVERIFY(account != 0);
+    QString displayName = account->displayName();
+    account->setDisplayName("Renamed account");
+    account->syncAndBlock();
+
+    call = getAccounts();
+    QVERIFY(!call.isError());
+    cacheStats = repliesCache();
+    QCOMPARE(cacheStats["hits"].toUInt(), 0U);
+    QCOMPARE(cacheStats["misses"].toUInt(), 1U);
+    bool found = false;
+    Q_FOREACH(const AccountInfo &info, call.argumentAt<0>()) {
+        if (int(info.id()) == m_firstAccountId + 2) {
+            QCOMPARE(info.data()[ONLINE_ACCOUNTS_INFO_KEY_DISPLAY_NAME].
+                     toString(), QString("Renamed account"));
+            found = true;
+        }
+    }
+    QVERIFY(found);
+
+    /* A daemon started with a valid snapshot loads libaccounts even if no
+     * client calls it, and hears about the changes from then on */
+    QVERIFY(waitForDaemonExit());
+    QTRY_VERIFY(callDebugMethod(m_dbus->sessionConnection(),
+                                "GetStartupTimings").toMap().
+                contains("activeAccountsLoaded"));
+    uint activations = managerStatistics()["activations"].toUInt();
+    account->setDisplayName("Renamed again");
+    account->syncAndBlock();
+    auto currentDisplayName = [&]() {
+        Q_FOREACH(const AccountInfo &info, getAccounts().argumentAt<0>()) {
+            if (int(info.id()) == m_firstAccountId + 2) {
+                return info.data()[ONLINE_ACCOUNTS_INFO_KEY_DISPLAY_NAME].
+                    toString();
+            }
+        }
+        return QString();
+    };
+    QTRY_COMPARE(currentDisplayName(), QString("Renamed again"));
+    /* Still the same daemon */
+    QCOMPARE(managerStatistics()["activations"].toUInt(), activations);
+
+    /* Install a new application while the daemon is not running */
+    QVERIFY(waitForDaemonExit());
+    QFile file(applicationsDir + "/com.ubuntu.tests_other.application");
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+               "<application id=\"com.ubuntu.tests_other\">\n"
+               "  <services>\n"
+               "    <service id=\"com.ubuntu.tests_coolshare\"/>\n"
+               "  </services>\n"
+               "</application>\n");
+    file.close();
+
+    call = getAccounts();
+    QVERIFY(!call.isError());
+    cacheStats = repliesCache();
+    QCOMPARE(cacheStats["hits"].toUInt(), 0U);
+    QCOMPARE(cacheStats["misses"].toUInt(), 1U);
+
+    account->setDisplayName(displayName);
+    account->syncAndBlock();
+    delete manager;
+    delete daemon;
+}
+
+void FunctionalTests::testIncrementalLoading()
+{
+    QVERIFY(QDir().mkpath(m_tmpDir->path() + "/accounts"));
+
+    /* More accounts than the daemon restores in one go */
+    const int accountCount = 25;
+    Accounts::Manager *manager =
+        new Accounts::Manager(Accounts::Manager::DisableNotifications, this);
+    Accounts::Service coolMail = manager->service("coolmail");
+    QSet<int> accountIds;
+    for (int i = 0; i < accountCount; i++) {
+        Accounts::Account *account = manager->createAccount("cool");
+        QVERIFY(account != 0);
+        account->setEnabled(true);
+        account->setDisplayName(QString("Account %1").arg(i));
+        account->selectService(coolMail);
+        account->setEnabled(true);
+        account->syncAndBlock();
+        accountIds.insert(account->id());
+    }
+    delete manager;
+
+    /* Not served from the cached replies, so that the daemon must look at
+     * the accounts DB */
+    QVariantMap filters;
+    filters["serviceId"] = "coolmail";
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    auto getAccountIds = [&]() {
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon->getAccounts(filters);
+        call.waitForFinished();
+        QSet<int> ids;
+        Q_FOREACH(const AccountInfo &info, call.argumentAt<0>()) {
+            ids.insert(info.id());
+        }
+        return ids;
+    };
+    QCOMPARE(getAccountIds(), accountIds);
+    QCOMPARE(managerStatistics()["activeAccounts"].toInt(), accountCount);
+
+    /* After a restart, the call reaches the daemon while the saved accounts
+     * are still being loaded */
+    QVERIFY(waitForDaemonExit());
+    QCOMPARE(getAccountIds(), accountIds);
+
+    QVariantMap timings =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetStartupTimings").toMap();
+    QVERIFY(timings.contains("activeAccountsLoaded"));
+    QVERIFY(timings["firstReply"].toLongLong() <
+            timings["activeAccountsLoaded"].toLongLong());
+
+    /* Loading completes with all the accounts */
+    QTRY_COMPARE(managerStatistics()["activeAccounts"].toInt(), accountCount);
+
+    delete daemon;
+}
+
+void FunctionalTests::testClientUsage()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    QVariantMap filters;
+    filters["applicationId"] = "com.ubuntu.tests_application";
+    for (int i = 0; i < 3; i++) {
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon->getAccounts(filters);
+        call.waitForFinished();
+        QVERIFY(!call.isError());
+    }
+
+    QVariantMap clientUsage =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetClientUsage").toMap();
+    QVERIFY(!clientUsage.isEmpty());
+    QCOMPARE(clientUsage["enabled"].toBool(), true);
+
+    QVariantMap clients = clientUsage["clients"].toMap();
+    QCOMPARE(clients.count(), 1);
+    QVariantMap usage = clients.first().toMap();
+    QCOMPARE(usage["name"].toString(),
+             m_dbus->sessionConnection().baseService());
+    QCOMPARE(usage["calls"].toUInt(), 3U);
+    QCOMPARE(usage["throttledCalls"].toUInt(), 0U);
+    /* GetAccounts is replied to right away, so it's never in flight */
+    QCOMPARE(usage["inFlight"].toInt(), 0);
+    QCOMPARE(usage["inFlightPeak"].toInt(), 0);
+    QCOMPARE(usage["signondSessions"].toInt(), 0);
+
+    delete daemon;
+}
+
+void FunctionalTests::testClientUnregistered()
+{
+    /* Register a few clients, then disconnect some of them: only those must
+     * be dropped by the daemon */
+    QStringList connectionNames;
+    QStringList busNames;
+    for (int i = 0; i < 4; i++) {
+        QDBusConnection connection =
+            QDBusConnection::connectToBus(m_dbus->sessionBus(),
+                                          QString("client-%1").arg(i));
+        QVERIFY(connection.isConnected());
+        DaemonInterface daemon(connection);
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon.getAccounts(QVariantMap());
+        call.waitForFinished();
+        QVERIFY(!call.isError());
+        connectionNames.append(connection.name());
+        busNames.append(connection.baseService());
+    }
+
+    auto registeredClients = [this]() {
+        QVariantMap clientUsage =
+            callDebugMethod(m_dbus->sessionConnection(),
+                            "GetClientUsage").toMap();
+        QStringList names;
+        Q_FOREACH(const QVariant &usage, clientUsage["clients"].toMap()) {
+            names.append(usage.toMap()["name"].toString());
+        }
+        names.sort();
+        return names;
+    };
+
+    QStringList expectedClients = busNames;
+    expectedClients.sort();
+    QCOMPARE(registeredClients(), expectedClients);
+
+    QDBusConnection::disconnectFromBus(connectionNames[1]);
+    QDBusConnection::disconnectFromBus(connectionNames[3]);
+    expectedClients = QStringList { busNames[0], busNames[2] };
+    expectedClients.sort();
+    QTRY_COMPARE(registeredClients(), expectedClients);
+
+    /* Give the daemon some more time: no other clients must go away */
+    QTest::qWait(200);
+    QCOMPARE(registeredClients(), expectedClients);
+
+    QDBusConnection::disconnectFromBus(connectionNames[0]);
+    QDBusConnection::disconnectFromBus(connectionNames[2]);
+    QTRY_COMPARE(registeredClients(), QStringList());
+}
+
+void FunctionalTests::testQuotas()
+{
+    DaemonInterface *daemon = new DaemonInterface(m_dbus->sessionConnection());
+    for (int i = 0; i < 2; i++) {
+        QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+            daemon->getAccounts(QVariantMap());
+        call.waitForFinished();
+        QVERIFY(!call.isError());
+    }
+
+    QDBusPendingReply<QList<AccountInfo>,QList<QVariantMap> > call =
+        daemon->getAccounts(QVariantMap());
+    call.waitForFinished();
+    QVERIFY(call.isError());
+    QCOMPARE(call.error().name(), QString(ONLINE_ACCOUNTS_ERROR_THROTTLED));
+
+    QDBusPendingReply<QVariantMap> authReply =
+        daemon->authenticate(m_firstAccountId + 3, "coolmail",
+                             false, false, QVariantMap());
+    authReply.waitForFinished();
+    QVERIFY(authReply.isError());
+    QCOMPARE(authReply.error().name(),
+             QString(ONLINE_ACCOUNTS_ERROR_THROTTLED));
+
+    QVariantMap clientUsage =
+        callDebugMethod(m_dbus->sessionConnection(),
+                        "GetClientUsage").toMap();
+    QVERIFY(!clientUsage.isEmpty());
+    QVariantMap quotas = clientUsage["quotas"].toMap();
+    QCOMPARE(quotas["callsPerMinute"].toUInt(), 2U);
+    QVariantMap clients = clientUsage["clients"].toMap();
+    QCOMPARE(clients.count(), 1);
+    QVariantMap usage = clients.first().toMap();
+    QCOMPARE(usage["calls"].toUInt(), 2U);
+    QCOMPARE(usage["throttledCalls"].toUInt(), 2U);
+
+    delete daemon;
 }
 
 QTEST_MAIN(FunctionalTests)
@@ -0,0 +1,149 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QObject>
+#include <QSignalSpy>
+#include <QTemporaryFile>
+#include <QTest>
+#include "inactivity_timer.h"
+
+using namespace OnlineAccountsDaemon;
+
+class IdleObject: public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool isIdle READ isIdle NOTIFY isIdleChanged)
+
+public:
+    IdleObject(): QObject(), m_isIdle(true) {}
+
+    bool isIdle() const { return m_isIdle; }
+
+Q_SIGNALS:
+    void isIdleChanged();
+
+private:
+    bool m_isIdle;
+};
+
+class InactivityTimerTest: public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testAdaptInterval_data();
+    void testAdaptInterval();
+    void testMemoryPressure_data();
+    void testMemoryPressure();
+};
+
+void InactivityTimerTest::testAdaptInterval_data()
+{
+    QTest::addColumn<int>("previousInterval");
+    QTest::addColumn<qint64>("msecsSinceExit");
+    QTest::addColumn<int>("expectedInterval");
+
+    /* The timer is created with a 1 second interval, 8 seconds maximum */
+    QTest::newRow("first run") << 0 << qint64(-1) << 1000;
+    QTest::newRow("previous above maximum") << 20000 << qint64(-1) << 8000;
+    QTest::newRow("respawned at exit") << 1000 << qint64(0) << 2000;
+    QTest::newRow("respawned soon") << 1000 << qint64(500) << 2000;
+    /* Twice the interval would have kept us alive up to 1000 ms after the
+     * exit, but not past that */
+    QTest::newRow("respawned just before doubled timeout") <<
+        1000 << qint64(999) << 2000;
+    QTest::newRow("respawned at doubled timeout") <<
+        1000 << qint64(1000) << 1000;
+    QTest::newRow("respawned soon, doubled") << 2000 << qint64(1999) << 4000;
+    QTest::newRow("respawned soon, at maximum") << 8000 << qint64(100) << 8000;
+    QTest::newRow("respawned after interval") << 2000 << qint64(2000) << 2000;
+    QTest::newRow("respawned later") << 4000 << qint64(16000) << 4000;
+    QTest::newRow("long pause, halved") << 4000 << qint64(16001) << 2000;
+    QTest::newRow("long pause, at minimum") << 1000 << qint64(100000) << 1000;
+}
+
+void InactivityTimerTest::testAdaptInterval()
+{
+    QFETCH(int, previousInterval);
+    QFETCH(qint64, msecsSinceExit);
+    QFETCH(int, expectedInterval);
+
+    InactivityTimer timer(1000);
+    timer.setMaximumInterval(8000);
+    QCOMPARE(timer.interval(), 1000);
+
+    timer.adaptInterval(previousInterval, msecsSinceExit);
+    QCOMPARE(timer.interval(), expectedInterval);
+}
+
+void InactivityTimerTest::testMemoryPressure_data()
+{
+    QTest::addColumn<QByteArray>("memInfo");
+    QTest::addColumn<bool>("isUnderPressure");
+
+    QTest::newRow("low memory") <<
+        QByteArray("MemTotal:        1000000 kB\n"
+                   "MemFree:           20000 kB\n"
+                   "MemAvailable:      50000 kB\n") <<
+        true;
+
+    QTest::newRow("enough memory") <<
+        QByteArray("MemTotal:        1000000 kB\n"
+                   "MemFree:          300000 kB\n"
+                   "MemAvailable:     500000 kB\n") <<
+        false;
+
+    QTest::newRow("no available memory info") <<
+        QByteArray("MemTotal:        1000000 kB\n"
+                   "MemFree:           20000 kB\n") <<
+        false;
+}
+
+void InactivityTimerTest::testMemoryPressure()
+{
+    QFETCH(QByteArray, memInfo);
+    QFETCH(bool, isUnderPressure);
+
+    QTemporaryFile memInfoFile;
+    QVERIFY(memInfoFile.open());
+    memInfoFile.write(memInfo);
+    memInfoFile.flush();
+
+    /* Under memory pressure, the minimum interval is used instead of the
+     * adapted one */
+    InactivityTimer timer(100);
+    timer.setMaximumInterval(5000);
+    timer.adaptInterval(5000, 10);
+    QCOMPARE(timer.interval(), 5000);
+    timer.setMemInfoFile(memInfoFile.fileName());
+
+    QSignalSpy timeout(&timer, SIGNAL(timeout()));
+    IdleObject object;
+    timer.watchObject(&object);
+
+    if (isUnderPressure) {
+        QVERIFY(timeout.wait(2000));
+    } else {
+        QVERIFY(!timeout.wait(1000));
+    }
+}
+
+QTEST_GUILESS_MAIN(InactivityTimerTest)
+#include "tst_inactivity_timer.moc"
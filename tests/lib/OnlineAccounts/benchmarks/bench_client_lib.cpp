@@ -0,0 +1,380 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "account_info.h"
+#include "authentication_data.h"
+#include "manager_p.h"
+#include "qtest_json_main.h"
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusMetaType>
+#include <QObject>
+#include <QTest>
+#include <libqtdbusmock/DBusMock.h>
+
+using namespace OnlineAccounts;
+
+/* Micro-benchmarks for the hot paths of the client library: demarshalling
+ * the account list, updating the account cache and building authentication
+ * replies. The library sources are built into this executable, so that the
+ * private classes can be exercised directly. */
+
+class ClientLibBenchmark: public QObject
+{
+    Q_OBJECT
+
+public:
+    ClientLibBenchmark();
+
+    OrgFreedesktopDBusMockInterface &mocked() {
+        return m_mock.mockInterface(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                    ONLINE_ACCOUNTS_MANAGER_PATH,
+                                    ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                                    QDBusConnection::SessionBus);
+    }
+
+    void addMockedMethod(const QString &name,
+                         const QString &in_sig,
+                         const QString &out_sig,
+                         const QString &code)
+    {
+        mocked().AddMethod(ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                           name, in_sig, out_sig, code).waitForFinished();
+    }
+
+private:
+    void setupAccounts(int accountCount, int settingCount);
+    ManagerPrivate *managerPrivate(Manager *manager);
+    static AccountInfo accountInfo(AccountId accountId, int settingCount);
+    static void addAccountsColumns();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanup();
+    void benchmarkDemarshalAccounts_data();
+    void benchmarkDemarshalAccounts();
+    void benchmarkEnsureAccount_data();
+    void benchmarkEnsureAccount();
+    void benchmarkAvailableAccounts_data();
+    void benchmarkAvailableAccounts();
+    void benchmarkAccountKeys_data();
+    void benchmarkAccountKeys();
+    void benchmarkAuthenticationReply_data();
+    void benchmarkAuthenticationReply();
+    void benchmarkRequestAccessReply_data();
+    void benchmarkRequestAccessReply();
+
+private:
+    QtDBusTest::DBusTestRunner m_dbus;
+    QtDBusMock::DBusMock m_mock;
+};
+
+ClientLibBenchmark::ClientLibBenchmark():
+    QObject(),
+    m_mock(m_dbus)
+{
+    m_mock.registerCustomMock(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                              ONLINE_ACCOUNTS_MANAGER_PATH,
+                              ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                              QDBusConnection::SessionBus);
+    m_dbus.startServices();
+}
+
+/* The reply is generated by the mock only when the parameters change, so
+ * that benchmark iterations don't pay for it. Accounts are spread over four
+ * services, named "service0" to "service3". */
+void ClientLibBenchmark::setupAccounts(int accountCount, int settingCount)
+{
+    addMockedMethod("GetAccounts", "a{sv}", "a(ua{sv})aa{sv}",
+        QString("key = (%1, %2)\n"
+                "if getattr(self, 'bench_key', None) != key:\n"
+                "  self.bench_accounts = [(i, dict(["
+                "    ('displayName', 'Account %d' % i),"
+                "    ('serviceId', 'service%d' % (i % 4)),"
+                "    ('authMethod', 2)] +"
+                "    [('settings/key%d' % k, 'value %d' % k)"
+                "     for k in range(%2)]))"
+                "    for i in range(1, %1 + 1)]\n"
+                "  self.bench_key = key\n"
+                "ret = (self.bench_accounts, [])").
+        arg(accountCount).arg(settingCount));
+}
+
+/* Accounts created by ManagerPrivate::ensureAccount() are parented to the
+ * ManagerPrivate object: request access to a new account to get hold of it. */
+ManagerPrivate *ClientLibBenchmark::managerPrivate(Manager *manager)
+{
+    addMockedMethod("RequestAccess", "sa{sv}", "(ua{sv})a{sv}",
+                    "ret = ((999999, {"
+                    "  'displayName': 'Access',"
+                    "  'serviceId': 'service0',"
+                    "  'authMethod': 2,"
+                    "}), {})");
+    RequestAccessReply reply(manager->requestAccess("service0", OAuth2Data()));
+    Account *account = reply.account();
+    return account ? qobject_cast<ManagerPrivate*>(account->parent()) : 0;
+}
+
+AccountInfo ClientLibBenchmark::accountInfo(AccountId accountId,
+                                            int settingCount)
+{
+    QVariantMap details {
+        { ONLINE_ACCOUNTS_INFO_KEY_DISPLAY_NAME,
+            QString("Account %1").arg(accountId) },
+        { ONLINE_ACCOUNTS_INFO_KEY_SERVICE_ID,
+            QString("service%1").arg(accountId % 4) },
+        { ONLINE_ACCOUNTS_INFO_KEY_AUTH_METHOD, 2 },
+        { ONLINE_ACCOUNTS_INFO_KEY_CHANGE_TYPE,
+            ONLINE_ACCOUNTS_INFO_CHANGE_UPDATED },
+    };
+    for (int k = 0; k < settingCount; k++) {
+        details.insert(QString(ONLINE_ACCOUNTS_INFO_KEY_SETTINGS "key%1").
+                       arg(k), QString("value %1").arg(k));
+    }
+    return AccountInfo(accountId, details);
+}
+
+void ClientLibBenchmark::addAccountsColumns()
+{
+    QTest::addColumn<int>("accountCount");
+    QTest::addColumn<int>("settingCount");
+
+    QTest::newRow("10 accounts") << 10 << 5;
+    QTest::newRow("100 accounts") << 100 << 5;
+    QTest::newRow("1000 accounts") << 1000 << 5;
+    QTest::newRow("10000 accounts") << 10000 << 5;
+    QTest::newRow("100 accounts; 200 settings") << 100 << 200;
+    QTest::newRow("1000 accounts; 200 settings") << 1000 << 200;
+}
+
+void ClientLibBenchmark::initTestCase()
+{
+    qDBusRegisterMetaType<AccountInfo>();
+    qDBusRegisterMetaType<QList<AccountInfo>>();
+    qDBusRegisterMetaType<QList<QVariantMap>>();
+}
+
+void ClientLibBenchmark::cleanup()
+{
+    /* Iterate the main loop in order to execute the delayed cleanup methods
+     * and avoid memory leaks.
+     */
+    QTest::qWait(10);
+}
+
+void ClientLibBenchmark::benchmarkDemarshalAccounts_data()
+{
+    addAccountsColumns();
+}
+
+void ClientLibBenchmark::benchmarkDemarshalAccounts()
+{
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                       ONLINE_ACCOUNTS_MANAGER_PATH,
+                                       ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                                       "GetAccounts");
+    msg << QVariantMap();
+    QDBusMessage reply = m_dbus.sessionConnection().call(msg);
+    QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+
+    /* Each cast reads from its own copy of the argument iterator */
+    QVariant accountsArgument = reply.arguments().at(0);
+    QList<AccountInfo> accounts;
+    QBENCHMARK {
+        accounts = qdbus_cast<QList<AccountInfo>>(accountsArgument);
+    }
+    QCOMPARE(accounts.count(), accountCount);
+}
+
+void ClientLibBenchmark::benchmarkEnsureAccount_data()
+{
+    addAccountsColumns();
+}
+
+void ClientLibBenchmark::benchmarkEnsureAccount()
+{
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+    Manager manager("bench-app", m_dbus.sessionConnection());
+    manager.waitForReady();
+    ManagerPrivate *d = managerPrivate(&manager);
+    QVERIFY(d);
+
+    QList<AccountInfo> accounts;
+    for (int i = 1; i <= accountCount; i++) {
+        accounts.append(accountInfo(i, settingCount));
+    }
+
+    /* The first pass creates the Account objects; the benchmark measures
+     * the update of existing accounts, which is what happens on every
+     * AccountChanged signal. */
+    Q_FOREACH(const AccountInfo &info, accounts) {
+        d->ensureAccount(info);
+    }
+
+    QBENCHMARK {
+        Q_FOREACH(const AccountInfo &info, accounts) {
+            d->ensureAccount(info);
+        }
+    }
+}
+
+void ClientLibBenchmark::benchmarkAvailableAccounts_data()
+{
+    QTest::addColumn<int>("accountCount");
+    QTest::addColumn<QString>("service");
+
+    QList<int> accountCounts { 10, 100, 1000, 10000 };
+    Q_FOREACH(int accountCount, accountCounts) {
+        QTest::newRow(QString("%1 accounts; all services").
+                      arg(accountCount).toUtf8().constData()) <<
+            accountCount << QString();
+        QTest::newRow(QString("%1 accounts; one service").
+                      arg(accountCount).toUtf8().constData()) <<
+            accountCount << QString("service1");
+    }
+}
+
+void ClientLibBenchmark::benchmarkAvailableAccounts()
+{
+    QFETCH(int, accountCount);
+    QFETCH(QString, service);
+
+    setupAccounts(accountCount, 5);
+    Manager manager("bench-app", m_dbus.sessionConnection());
+    manager.waitForReady();
+
+    QList<Account*> accounts;
+    QBENCHMARK {
+        accounts = manager.availableAccounts(service);
+    }
+    QCOMPARE(accounts.count(),
+             service.isEmpty() ? accountCount : (accountCount + 3) / 4);
+}
+
+void ClientLibBenchmark::benchmarkAccountKeys_data()
+{
+    QTest::addColumn<int>("settingCount");
+
+    QTest::newRow("5 settings") << 5;
+    QTest::newRow("50 settings") << 50;
+    QTest::newRow("500 settings") << 500;
+}
+
+void ClientLibBenchmark::benchmarkAccountKeys()
+{
+    QFETCH(int, settingCount);
+
+    AccountInfo info = accountInfo(1, settingCount);
+
+    QStringList keys;
+    QBENCHMARK {
+        keys = info.keys();
+    }
+    QCOMPARE(keys.count(), settingCount);
+}
+
+/* The reply contains plain values, nested dictionaries and byte arrays
+ * lists, all of which must go through expandDBusArguments(). */
+static QString authenticationReplyCode(int entryCount)
+{
+    return QString("ret = dict([('AccessToken', 'my token'),"
+                   "  ('ExpiresIn', 3600)] +"
+                   "  [('key%d' % k, 'value %d' % k) for k in range(%1)])\n"
+                   "ret['Extra'] = dbus.Dictionary(dict("
+                   "  ('key%d' % k, dbus.Dictionary({'n': k}, signature='sv'))"
+                   "  for k in range(%1)), signature='sv')\n"
+                   "ret['Certificates'] = dbus.Array("
+                   "  [dbus.ByteArray(b'x' * 512)] * %1, signature='ay')").
+        arg(entryCount);
+}
+
+void ClientLibBenchmark::benchmarkAuthenticationReply_data()
+{
+    QTest::addColumn<int>("entryCount");
+
+    QTest::newRow("10 entries") << 10;
+    QTest::newRow("100 entries") << 100;
+    QTest::newRow("1000 entries") << 1000;
+}
+
+void ClientLibBenchmark::benchmarkAuthenticationReply()
+{
+    QFETCH(int, entryCount);
+
+    setupAccounts(1, 5);
+    addMockedMethod("Authenticate", "usbba{sv}", "a{sv}",
+                    authenticationReplyCode(entryCount));
+    Manager manager("bench-app", m_dbus.sessionConnection());
+    manager.waitForReady();
+    Account *account = manager.account(1);
+    QVERIFY(account);
+
+    PendingCall call = account->authenticate(OAuth2Data());
+    call.waitForFinished();
+    QVERIFY(!OAuth2Reply(call).hasError());
+
+    QBENCHMARK {
+        OAuth2Reply reply(call);
+    }
+}
+
+void ClientLibBenchmark::benchmarkRequestAccessReply_data()
+{
+    benchmarkAuthenticationReply_data();
+}
+
+void ClientLibBenchmark::benchmarkRequestAccessReply()
+{
+    QFETCH(int, entryCount);
+
+    setupAccounts(1, 5);
+    addMockedMethod("RequestAccess", "sa{sv}", "(ua{sv})a{sv}",
+                    authenticationReplyCode(entryCount) + "\n"
+                    "ret = ((1, {"
+                    "  'displayName': 'Account 1',"
+                    "  'serviceId': 'service1',"
+                    "  'authMethod': 2,"
+                    "}), ret)");
+    Manager manager("bench-app", m_dbus.sessionConnection());
+    manager.waitForReady();
+
+    PendingCall call = manager.requestAccess("service1", OAuth2Data());
+    call.waitForFinished();
+    QVERIFY(!RequestAccessReply(call).hasError());
+
+    QBENCHMARK {
+        RequestAccessReply accessReply(call);
+        OAuth2Reply reply(call);
+    }
+}
+
+QTEST_JSON_MAIN(ClientLibBenchmark, "bench_client_lib")
+
+#include "bench_client_lib.moc"
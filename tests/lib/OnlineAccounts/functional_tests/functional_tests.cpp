@@ -85,6 +85,7 @@ private Q_SLOTS:
     void testConstructor();
     void testManagerReady_data();
     void testManagerReady();
+    void testManagerReadyThrottled();
     void testManagerAvailableAccounts_data();
     void testManagerAvailableAccounts();
     void testManagerAvailableServices_data();
@@ -158,6 +159,31 @@ void FunctionalTests::testManagerReady()
     QCOMPARE(ready.count(), 1);
 }
 
+void FunctionalTests::testManagerReadyThrottled()
+{
+    /* The first call is throttled; the manager must retry it, instead of
+     * becoming ready without accounts. waitForReady() doesn't wait for the
+     * retry. */
+    addMockedMethod("GetAccounts", "a{sv}", "a(ua{sv})aa{sv}",
+                    "if not getattr(self, 'throttled', False):\n"
+                    "  self.throttled = True\n"
+                    "  raise dbus.exceptions.DBusException('Slow down',"
+                    "    name='" ONLINE_ACCOUNTS_ERROR_THROTTLED "')\n"
+                    "ret = ([(1, {'displayName': 'Tom'})], [])");
+    OnlineAccounts::Manager manager("my-app");
+
+    QSignalSpy ready(&manager, SIGNAL(ready()));
+
+    manager.waitForReady();
+    QVERIFY(!manager.isReady());
+    QCOMPARE(ready.count(), 0);
+
+    QVERIFY(ready.wait());
+    QVERIFY(manager.isReady());
+    QCOMPARE(ready.count(), 1);
+    QCOMPARE(manager.availableAccounts().count(), 1);
+}
+
 void FunctionalTests::testManagerAvailableAccounts_data()
 {
     QTest::addColumn<QString>("reply");
@@ -758,6 +784,12 @@ void FunctionalTests::testAuthenticationErrors_data()
         "name='" ONLINE_ACCOUNTS_ERROR_INTERACTION_REQUIRED "')" <<
         int(OnlineAccounts::Error::InteractionRequired) <<
         "Ask the user";
+
+    QTest::newRow("throttled") <<
+        "raise dbus.exceptions.DBusException('Slow down',"
+        "name='" ONLINE_ACCOUNTS_ERROR_THROTTLED "')" <<
+        int(OnlineAccounts::Error::Throttled) <<
+        "Slow down";
 }
 
 void FunctionalTests::testAuthenticationErrors()
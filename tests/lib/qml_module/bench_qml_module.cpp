@@ -0,0 +1,398 @@
+/*
+ * This file is part of OnlineAccountsModule
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "OnlineAccountsDaemon/dbus_constants.h"
+#include "qtest_json_main.h"
+#include <QAbstractListModel>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QElapsedTimer>
+#include <QJSValue>
+#include <QObject>
+#include <QQmlComponent>
+#include <QQmlEngine>
+#include <QSignalSpy>
+#include <QTest>
+#include <libqtdbusmock/DBusMock.h>
+
+/* Benchmarks for the AccountModel QML element, with large account sets. The
+ * OnlineAccounts manager service is mocked, as in tst_qml_module. */
+
+class ModuleBenchmark: public QObject
+{
+    Q_OBJECT
+
+public:
+    ModuleBenchmark();
+
+    OrgFreedesktopDBusMockInterface &mocked() {
+        return m_mock.mockInterface(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                    ONLINE_ACCOUNTS_MANAGER_PATH,
+                                    ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                                    QDBusConnection::SessionBus);
+    }
+
+    void addMockedMethod(const QString &name,
+                         const QString &in_sig,
+                         const QString &out_sig,
+                         const QString &code)
+    {
+        mocked().AddMethod(ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                           name, in_sig, out_sig, code).waitForFinished();
+    }
+
+private:
+    void setupAccounts(int accountCount, int settingCount,
+                       int serviceCount = 4);
+    QObject *createModel(QQmlEngine *engine);
+    bool waitForReady(QObject *model);
+    static void addAccountsColumns();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanup();
+    void benchmarkReady_data();
+    void benchmarkReady();
+    void benchmarkServiceIdSwitch_data();
+    void benchmarkServiceIdSwitch();
+    void benchmarkRoleData_data();
+    void benchmarkRoleData();
+    void benchmarkAccountList_data();
+    void benchmarkAccountList();
+    void benchmarkServiceList_data();
+    void benchmarkServiceList();
+    void benchmarkAccountChangedBurst_data();
+    void benchmarkAccountChangedBurst();
+
+private:
+    QtDBusTest::DBusTestRunner m_dbus;
+    QtDBusMock::DBusMock m_mock;
+};
+
+ModuleBenchmark::ModuleBenchmark():
+    QObject(),
+    m_mock(m_dbus)
+{
+    m_mock.registerCustomMock(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                              ONLINE_ACCOUNTS_MANAGER_PATH,
+                              ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                              QDBusConnection::SessionBus);
+    m_dbus.startServices();
+}
+
+/* The reply is generated by the mock only when the parameters change, so
+ * that benchmark iterations don't pay for it. Account N provides the
+ * service "service<N % serviceCount>". */
+void ModuleBenchmark::setupAccounts(int accountCount, int settingCount,
+                                    int serviceCount)
+{
+    addMockedMethod("GetAccounts", "a{sv}", "a(ua{sv})aa{sv}",
+        QString("key = (%1, %2, %3)\n"
+                "if getattr(self, 'bench_key', None) != key:\n"
+                "  self.bench_accounts = [(i, dict(["
+                "    ('displayName', 'Account %d' % i),"
+                "    ('serviceId', 'service%d' % (i % %3)),"
+                "    ('authMethod', 2),"
+                "    ('settings/Port', 7000 + i)] +"
+                "    [('settings/key%d' % k, 'value %d' % k)"
+                "     for k in range(%2)]))"
+                "    for i in range(1, %1 + 1)]\n"
+                "  self.bench_services = [{"
+                "    'serviceId': 'service%d' % s,"
+                "    'displayName': 'Service %d' % s,"
+                "    'iconSource': 'image://theme/service%d' % s,"
+                "  } for s in range(%3)]\n"
+                "  self.bench_key = key\n"
+                "ret = (self.bench_accounts, self.bench_services)").
+        arg(accountCount).arg(settingCount).arg(serviceCount));
+}
+
+QObject *ModuleBenchmark::createModel(QQmlEngine *engine)
+{
+    QQmlComponent component(engine);
+    component.setData("import Ubuntu.OnlineAccounts 2.0\n"
+                      "AccountModel { applicationId: \"bench-app\" }",
+                      QUrl());
+    return component.create();
+}
+
+bool ModuleBenchmark::waitForReady(QObject *model)
+{
+    QSignalSpy isReadyChanged(model, SIGNAL(isReadyChanged()));
+    while (!model->property("ready").toBool()) {
+        if (!isReadyChanged.wait()) return false;
+    }
+    return true;
+}
+
+void ModuleBenchmark::addAccountsColumns()
+{
+    QTest::addColumn<int>("accountCount");
+    QTest::addColumn<int>("settingCount");
+
+    QTest::newRow("10 accounts") << 10 << 5;
+    QTest::newRow("100 accounts") << 100 << 5;
+    QTest::newRow("1000 accounts") << 1000 << 5;
+    QTest::newRow("10000 accounts") << 10000 << 5;
+    QTest::newRow("1000 accounts; 200 settings") << 1000 << 200;
+}
+
+void ModuleBenchmark::initTestCase()
+{
+    qputenv("QML2_IMPORT_PATH", TEST_QML_IMPORT_PATH);
+}
+
+void ModuleBenchmark::cleanup()
+{
+    /* Iterate the main loop in order to execute the delayed cleanup methods
+     * and avoid memory leaks.
+     */
+    QTest::qWait(10);
+}
+
+void ModuleBenchmark::benchmarkReady_data()
+{
+    addAccountsColumns();
+}
+
+/* Measures the time from the model creation to the "ready" state; this
+ * includes the GetAccounts round trip and, since each iteration must start
+ * from scratch, the destruction of the model. */
+void ModuleBenchmark::benchmarkReady()
+{
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+    QQmlEngine engine;
+
+    QBENCHMARK {
+        QObject *model = createModel(&engine);
+        QVERIFY(model);
+        QVERIFY(waitForReady(model));
+        QCOMPARE(model->property("count").toInt(), accountCount);
+        delete model;
+    }
+}
+
+void ModuleBenchmark::benchmarkServiceIdSwitch_data()
+{
+    addAccountsColumns();
+}
+
+/* Alternates between all the accounts and the accounts of a single service */
+void ModuleBenchmark::benchmarkServiceIdSwitch()
+{
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+    QQmlEngine engine;
+    QScopedPointer<QObject> model(createModel(&engine));
+    QVERIFY(model);
+    QVERIFY(waitForReady(model.data()));
+
+    bool filtered = false;
+    QBENCHMARK {
+        filtered = !filtered;
+        model->setProperty("serviceId",
+                           filtered ? QString("service1") : QString());
+        QVERIFY(waitForReady(model.data()));
+    }
+}
+
+void ModuleBenchmark::benchmarkRoleData_data()
+{
+    QTest::addColumn<QByteArray>("roleName");
+    QTest::addColumn<int>("accountCount");
+    QTest::addColumn<int>("settingCount");
+
+    QList<QByteArray> roleNames {
+        "displayName",
+        "valid",
+        "accountId",
+        "serviceId",
+        "authenticationMethod",
+        "settings",
+        "account",
+        "service",
+    };
+    Q_FOREACH(const QByteArray &roleName, roleNames) {
+        QTest::newRow(QByteArray(roleName + "; 5 settings").constData()) <<
+            roleName << 1000 << 5;
+        QTest::newRow(QByteArray(roleName + "; 200 settings").constData()) <<
+            roleName << 1000 << 200;
+    }
+}
+
+/* Reads the role from all the rows, as a view scrolling through the whole
+ * model would do */
+void ModuleBenchmark::benchmarkRoleData()
+{
+    QFETCH(QByteArray, roleName);
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+    QQmlEngine engine;
+    QScopedPointer<QObject> object(createModel(&engine));
+    QAbstractListModel *model =
+        qobject_cast<QAbstractListModel*>(object.data());
+    QVERIFY(model);
+    QVERIFY(waitForReady(model));
+
+    int role = model->roleNames().key(roleName, -1);
+    QVERIFY(role >= 0);
+    int rowCount = model->rowCount();
+    QCOMPARE(rowCount, accountCount);
+
+    QBENCHMARK {
+        for (int row = 0; row < rowCount; row++) {
+            QVariant value = model->data(model->index(row), role);
+            Q_UNUSED(value);
+        }
+    }
+}
+
+void ModuleBenchmark::benchmarkAccountList_data()
+{
+    addAccountsColumns();
+}
+
+void ModuleBenchmark::benchmarkAccountList()
+{
+    QFETCH(int, accountCount);
+    QFETCH(int, settingCount);
+
+    setupAccounts(accountCount, settingCount);
+    QQmlEngine engine;
+    QScopedPointer<QObject> model(createModel(&engine));
+    QVERIFY(model);
+    QVERIFY(waitForReady(model.data()));
+
+    QObjectList accounts;
+    QBENCHMARK {
+        accounts = model->property("accountList").value<QObjectList>();
+    }
+    QCOMPARE(accounts.count(), accountCount);
+}
+
+void ModuleBenchmark::benchmarkServiceList_data()
+{
+    QTest::addColumn<int>("serviceCount");
+
+    QTest::newRow("4 services") << 4;
+    QTest::newRow("40 services") << 40;
+    QTest::newRow("400 services") << 400;
+}
+
+void ModuleBenchmark::benchmarkServiceList()
+{
+    QFETCH(int, serviceCount);
+
+    setupAccounts(100, 5, serviceCount);
+    QQmlEngine engine;
+    QScopedPointer<QObject> model(createModel(&engine));
+    QVERIFY(model);
+    QVERIFY(waitForReady(model.data()));
+
+    QJSValue services;
+    QBENCHMARK {
+        services = model->property("serviceList").value<QJSValue>();
+    }
+    QCOMPARE(services.property("length").toInt(), serviceCount);
+}
+
+void ModuleBenchmark::benchmarkAccountChangedBurst_data()
+{
+    QTest::addColumn<int>("burstSize");
+
+    QTest::newRow("10 changes") << 10;
+    QTest::newRow("100 changes") << 100;
+    QTest::newRow("1000 changes") << 1000;
+}
+
+/* The mocked service emits a burst of AccountChanged signals, each updating
+ * the display name of a different account. The signals are sent while the
+ * test is blocked waiting for the reply from the mock, which comes after all
+ * of them: the measured time starts when they are all queued, and ends with
+ * the last dataChanged() emission from the model.
+ *
+ * The signals cannot be sent from another connection of the test process,
+ * since the client library only accepts them from the owner of the service
+ * name. */
+void ModuleBenchmark::benchmarkAccountChangedBurst()
+{
+    QFETCH(int, burstSize);
+
+    setupAccounts(1000, 5);
+    addMockedMethod("EmitAccountChangedBurst", "uu", "",
+        QString("for i in range(1, args[0] + 1):\n"
+                "  self.EmitSignal('" ONLINE_ACCOUNTS_MANAGER_INTERFACE "',"
+                "    'AccountChanged', 's(ua{sv})', ["
+                "      'service%d' % (i % 4),"
+                "      dbus.Struct((dbus.UInt32(i), dbus.Dictionary({"
+                "        '" ONLINE_ACCOUNTS_INFO_KEY_DISPLAY_NAME "':"
+                "          'Account %d-%d' % (i, args[1]),"
+                "        '" ONLINE_ACCOUNTS_INFO_KEY_SERVICE_ID "':"
+                "          'service%d' % (i % 4),"
+                "        '" ONLINE_ACCOUNTS_INFO_KEY_AUTH_METHOD "': 2,"
+                "        '" ONLINE_ACCOUNTS_INFO_KEY_CHANGE_TYPE "':"
+                "          dbus.UInt32(%1),"
+                "      }, signature='sv')), signature='ua{sv}')])").
+        arg(ONLINE_ACCOUNTS_INFO_CHANGE_UPDATED));
+
+    QQmlEngine engine;
+    QScopedPointer<QObject> model(createModel(&engine));
+    QVERIFY(model);
+    QVERIFY(waitForReady(model.data()));
+
+    QSignalSpy dataChanged(model.data(),
+                           SIGNAL(dataChanged(const QModelIndex&,
+                                              const QModelIndex&)));
+    const uint rounds = 10;
+    qint64 elapsedNsecs = 0;
+    for (uint round = 1; round <= rounds; round++) {
+        dataChanged.clear();
+        QDBusMessage msg =
+            QDBusMessage::createMethodCall(ONLINE_ACCOUNTS_MANAGER_SERVICE_NAME,
+                                           ONLINE_ACCOUNTS_MANAGER_PATH,
+                                           ONLINE_ACCOUNTS_MANAGER_INTERFACE,
+                                           "EmitAccountChangedBurst");
+        msg << uint(burstSize) << round;
+        QDBusMessage reply = QDBusConnection::sessionBus().call(msg);
+        QCOMPARE(reply.type(), QDBusMessage::ReplyMessage);
+        QCOMPARE(dataChanged.count(), 0);
+
+        QElapsedTimer timer;
+        timer.start();
+        while (dataChanged.count() < burstSize) {
+            if (!dataChanged.wait()) break;
+        }
+        elapsedNsecs += timer.nsecsElapsed();
+        QCOMPARE(dataChanged.count(), burstSize);
+    }
+    QTest::setBenchmarkResult(elapsedNsecs / 1000000.0 / rounds,
+                              QTest::WalltimeMilliseconds);
+}
+
+QTEST_JSON_MAIN(ModuleBenchmark, "bench_qml_module")
+
+#include "bench_qml_module.moc"
@@ -0,0 +1,270 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "accounts_db_generator.h"
+
+#include <Accounts/Account>
+#include <Accounts/Manager>
+#include <Accounts/Service>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QXmlStreamWriter>
+#include <functional>
+
+AccountsDbGenerator::AccountsDbGenerator(const QString &directory):
+    m_directory(directory),
+    m_accountCount(10),
+    m_providerCount(1),
+    m_servicesPerAccount(2),
+    m_settingsPerService(5),
+    m_applicationCount(1),
+    m_credentialsId(41)
+{
+}
+
+AccountsDbGenerator::~AccountsDbGenerator()
+{
+}
+
+QString AccountsDbGenerator::providerId(int provider)
+{
+    return QString("gen-provider-%1").arg(provider);
+}
+
+QString AccountsDbGenerator::serviceId(int provider, int service)
+{
+    return QString("com.ubuntu.gen_provider-%1-service-%2").
+        arg(provider).arg(service);
+}
+
+QString AccountsDbGenerator::applicationId(int application)
+{
+    return QString("com.ubuntu.gen_application-%1").arg(application);
+}
+
+QString AccountsDbGenerator::providersDir() const
+{
+    return m_directory + "/providers";
+}
+
+QString AccountsDbGenerator::servicesDir() const
+{
+    return m_directory + "/services";
+}
+
+QString AccountsDbGenerator::applicationsDir() const
+{
+    return m_directory + "/applications";
+}
+
+void AccountsDbGenerator::setEnvironment() const
+{
+    qputenv("ACCOUNTS", m_directory.toUtf8());
+    qputenv("AG_PROVIDERS", providersDir().toUtf8());
+    qputenv("AG_SERVICES", servicesDir().toUtf8());
+    qputenv("AG_SERVICE_TYPES", servicesDir().toUtf8());
+    qputenv("AG_APPLICATIONS", applicationsDir().toUtf8());
+}
+
+bool AccountsDbGenerator::generate()
+{
+    if (Q_UNLIKELY(m_providerCount <= 0 || m_accountCount < 0 ||
+                   m_servicesPerAccount < 0 || m_settingsPerService < 0 ||
+                   m_applicationCount < 0)) {
+        qWarning() << "Invalid generator parameters";
+        return false;
+    }
+
+    return writeCatalog() && writeDb();
+}
+
+bool AccountsDbGenerator::writeCatalog()
+{
+    QStringList dirs;
+    dirs << providersDir() << servicesDir() << applicationsDir();
+    Q_FOREACH(const QString &path, dirs) {
+        QDir dir(path);
+        if (dir.exists()) dir.removeRecursively();
+        if (Q_UNLIKELY(!dir.mkpath("."))) {
+            qWarning() << "Cannot create directory" << path;
+            return false;
+        }
+    }
+
+    for (int p = 0; p < m_providerCount; p++) {
+        if (!writeProvider(p)) return false;
+        for (int s = 0; s < m_servicesPerAccount; s++) {
+            if (!writeService(p, s)) return false;
+        }
+    }
+
+    for (int a = 0; a < m_applicationCount; a++) {
+        if (!writeApplication(a)) return false;
+    }
+
+    return true;
+}
+
+static bool writeXml(const QString &fileName,
+                     const std::function<void(QXmlStreamWriter &)> &body)
+{
+    QFile file(fileName);
+    if (Q_UNLIKELY(!file.open(QIODevice::WriteOnly))) {
+        qWarning() << "Cannot write" << fileName;
+        return false;
+    }
+
+    QXmlStreamWriter xml(&file);
+    xml.setAutoFormatting(true);
+    xml.writeStartDocument();
+    body(xml);
+    xml.writeEndDocument();
+    return !xml.hasError();
+}
+
+bool AccountsDbGenerator::writeProvider(int provider)
+{
+    QString id = providerId(provider);
+    return writeXml(providersDir() + '/' + id + ".provider",
+                    [&](QXmlStreamWriter &xml) {
+        xml.writeStartElement("provider");
+        xml.writeAttribute("id", id);
+        xml.writeTextElement("name", QString("Provider %1").arg(provider));
+        xml.writeTextElement("icon", "general_myprovider");
+        xml.writeEndElement();
+    });
+}
+
+bool AccountsDbGenerator::writeService(int provider, int service)
+{
+    QString id = serviceId(provider, service);
+    return writeXml(servicesDir() + '/' + id + ".service",
+                    [&](QXmlStreamWriter &xml) {
+        xml.writeStartElement("service");
+        xml.writeAttribute("id", id);
+        xml.writeTextElement("type", QString("gen-type-%1").arg(service));
+        xml.writeTextElement("name", QString("Service %1 of provider %2").
+                             arg(service).arg(provider));
+        xml.writeTextElement("icon", "general_myservice");
+        xml.writeTextElement("provider", providerId(provider));
+
+        /* The daemon needs to know the authentication method */
+        xml.writeStartElement("template");
+        xml.writeStartElement("group");
+        xml.writeAttribute("name", "auth");
+        xml.writeStartElement("setting");
+        xml.writeAttribute("name", "method");
+        xml.writeCharacters("oauth2");
+        xml.writeEndElement();
+        xml.writeStartElement("setting");
+        xml.writeAttribute("name", "mechanism");
+        xml.writeCharacters("user_agent");
+        xml.writeEndElement();
+        xml.writeEndElement(); // group
+        xml.writeEndElement(); // template
+
+        xml.writeEndElement();
+    });
+}
+
+bool AccountsDbGenerator::writeApplication(int application)
+{
+    QString id = applicationId(application);
+    int provider = application % m_providerCount;
+    return writeXml(applicationsDir() + '/' + id + ".application",
+                    [&](QXmlStreamWriter &xml) {
+        xml.writeStartElement("application");
+        xml.writeAttribute("id", id);
+        xml.writeTextElement("description",
+                             QString("Application %1").arg(application));
+        xml.writeStartElement("services");
+        for (int s = 0; s < m_servicesPerAccount; s++) {
+            xml.writeStartElement("service");
+            xml.writeAttribute("id", serviceId(provider, s));
+            xml.writeTextElement("description", "Generated service");
+            xml.writeEndElement();
+        }
+        xml.writeEndElement(); // services
+        xml.writeTextElement("profile", id + "_0.1");
+        xml.writeEndElement();
+    });
+}
+
+static QVariant settingValue(int setting, int account)
+{
+    /* A mix of the most common types */
+    switch (setting % 3) {
+    case 0: return QString("value %1 of account %2").arg(setting).arg(account);
+    case 1: return setting * 1000 + account;
+    default: return bool(account % 2);
+    }
+}
+
+bool AccountsDbGenerator::writeDb()
+{
+    QDir dbroot(m_directory);
+    dbroot.remove("accounts.db");
+    dbroot.remove("accounts.db-wal");
+    dbroot.remove("accounts.db-shm");
+
+    setEnvironment();
+
+    m_accountIds.clear();
+    Accounts::Manager *manager =
+        new Accounts::Manager(Accounts::Manager::DisableNotifications);
+
+    QList<Accounts::ServiceList> services;
+    for (int p = 0; p < m_providerCount; p++) {
+        Accounts::ServiceList providerServices;
+        for (int s = 0; s < m_servicesPerAccount; s++) {
+            providerServices.append(manager->service(serviceId(p, s)));
+        }
+        services.append(providerServices);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < m_accountCount && ok; i++) {
+        int provider = i % m_providerCount;
+        Accounts::Account *account =
+            manager->createAccount(providerId(provider));
+        account->setEnabled(true);
+        account->setDisplayName(QString("Account %1").arg(i));
+        account->setCredentialsId(m_credentialsId);
+
+        Q_FOREACH(const Accounts::Service &service, services[provider]) {
+            account->selectService(service);
+            account->setEnabled(true);
+            for (int k = 0; k < m_settingsPerService; k++) {
+                account->setValue(QString("setting%1").arg(k),
+                                  settingValue(k, i));
+            }
+        }
+        ok = account->syncAndBlock();
+        if (Q_UNLIKELY(!ok)) {
+            qWarning() << "Couldn't store account" << i;
+        }
+        m_accountIds.append(account->id());
+        delete account;
+    }
+
+    delete manager;
+    return ok;
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OAD_ACCOUNTS_DB_GENERATOR_H
+#define OAD_ACCOUNTS_DB_GENERATOR_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/* Creates a libaccounts database, together with the provider, service and
+ * application files it refers to, all inside a single directory.
+ *
+ * Each provider has servicesPerAccount() services, and each account is
+ * enabled on all the services of its provider, with settingsPerService()
+ * settings stored for each of them. Application N uses the services of
+ * provider N modulo providerCount().
+ *
+ * Services and applications are named as if they were shipped by the
+ * "com.ubuntu.gen" click package, so that they are accessible to confined
+ * clients from that package too.
+ */
+class AccountsDbGenerator
+{
+public:
+    AccountsDbGenerator(const QString &directory);
+    ~AccountsDbGenerator();
+
+    void setAccountCount(int count) { m_accountCount = count; }
+    int accountCount() const { return m_accountCount; }
+
+    void setProviderCount(int count) { m_providerCount = count; }
+    int providerCount() const { return m_providerCount; }
+
+    void setServicesPerAccount(int count) { m_servicesPerAccount = count; }
+    int servicesPerAccount() const { return m_servicesPerAccount; }
+
+    void setSettingsPerService(int count) { m_settingsPerService = count; }
+    int settingsPerService() const { return m_settingsPerService; }
+
+    void setApplicationCount(int count) { m_applicationCount = count; }
+    int applicationCount() const { return m_applicationCount; }
+
+    /* Used as credentials ID of all the accounts */
+    void setCredentialsId(uint id) { m_credentialsId = id; }
+    uint credentialsId() const { return m_credentialsId; }
+
+    static QString providerId(int provider);
+    static QString serviceId(int provider, int service);
+    static QString applicationId(int application);
+
+    QString directory() const { return m_directory; }
+    QString providersDir() const;
+    QString servicesDir() const;
+    QString applicationsDir() const;
+
+    /* Points libaccounts (in this process and in the ones it starts) to
+     * the generated files; generate() calls this too. */
+    void setEnvironment() const;
+
+    /* Replaces any previously generated data */
+    bool generate();
+
+    QList<uint> accountIds() const { return m_accountIds; }
+
+private:
+    bool writeCatalog();
+    bool writeProvider(int provider);
+    bool writeService(int provider, int service);
+    bool writeApplication(int application);
+    bool writeDb();
+
+private:
+    QString m_directory;
+    int m_accountCount;
+    int m_providerCount;
+    int m_servicesPerAccount;
+    int m_settingsPerService;
+    int m_applicationCount;
+    uint m_credentialsId;
+    QList<uint> m_accountIds;
+};
+
+#endif // OAD_ACCOUNTS_DB_GENERATOR_H
@@ -0,0 +1,90 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "accounts_db_generator.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QTextStream>
+#include <cstdlib>
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Creates an accounts DB with the matching provider, service and "
+        "application files");
+    parser.addHelpOption();
+    parser.addPositionalArgument("directory",
+                                 "Where to write the generated files");
+    QCommandLineOption accountsOption("accounts",
+        "Number of accounts", "count", "10");
+    QCommandLineOption providersOption("providers",
+        "Number of providers", "count", "1");
+    QCommandLineOption servicesOption("services",
+        "Number of services per account", "count", "2");
+    QCommandLineOption settingsOption("settings",
+        "Number of settings per service", "count", "5");
+    QCommandLineOption applicationsOption("applications",
+        "Number of applications", "count", "1");
+    QCommandLineOption credentialsOption("credentials-id",
+        "Credentials ID of the accounts", "id", "41");
+    parser.addOption(accountsOption);
+    parser.addOption(providersOption);
+    parser.addOption(servicesOption);
+    parser.addOption(settingsOption);
+    parser.addOption(applicationsOption);
+    parser.addOption(credentialsOption);
+    parser.process(app);
+
+    if (parser.positionalArguments().count() != 1) {
+        parser.showHelp(EXIT_FAILURE);
+    }
+
+    QDir directory(parser.positionalArguments().first());
+    if (!directory.mkpath(".")) {
+        qCritical("Cannot create %s", qPrintable(directory.path()));
+        return EXIT_FAILURE;
+    }
+
+    AccountsDbGenerator generator(directory.absolutePath());
+    generator.setAccountCount(parser.value(accountsOption).toInt());
+    generator.setProviderCount(parser.value(providersOption).toInt());
+    generator.setServicesPerAccount(parser.value(servicesOption).toInt());
+    generator.setSettingsPerService(parser.value(settingsOption).toInt());
+    generator.setApplicationCount(parser.value(applicationsOption).toInt());
+    generator.setCredentialsId(parser.value(credentialsOption).toUInt());
+    if (!generator.generate()) {
+        return EXIT_FAILURE;
+    }
+
+    /* Ready to be eval'ed by a shell */
+    QTextStream out(stdout);
+    out << "export ACCOUNTS=" << generator.directory() << '\n';
+    out << "export AG_PROVIDERS=" << generator.providersDir() << '\n';
+    out << "export AG_SERVICES=" << generator.servicesDir() << '\n';
+    out << "export AG_SERVICE_TYPES=" << generator.servicesDir() << '\n';
+    out << "export AG_APPLICATIONS=" << generator.applicationsDir() << '\n';
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/*
+ * This file is part of libOnlineAccounts
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OAD_QTEST_JSON_MAIN_H
+#define OAD_QTEST_JSON_MAIN_H
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTest>
+#include <cstdlib>
+
+/* QTest in Qt 5 has no JSON logger: when the benchmark is given
+ * "--json <file>", the results are logged in CSV format and then converted.
+ * All the other options are passed to QTest unchanged. */
+
+namespace QTestJson {
+
+inline bool writeResults(const QString &benchmarkName,
+                         const QString &csvFileName,
+                         const QString &jsonFileName)
+{
+    QFile csvFile(csvFileName);
+    if (!csvFile.open(QIODevice::ReadOnly)) return false;
+
+    QRegularExpression line("^\"([^\"]*)\",\"([^\"]*)\",\"([^\"]*)\","
+                            "([^,]+),([^,]+),(\\d+)$");
+    QJsonArray results;
+    while (!csvFile.atEnd()) {
+        QString text = QString::fromUtf8(csvFile.readLine()).trimmed();
+        QRegularExpressionMatch match = line.match(text);
+        if (!match.hasMatch()) continue;
+        results.append(QJsonObject {
+            { "function", match.captured(1) },
+            { "tag", match.captured(2) },
+            { "metric", match.captured(3) },
+            { "value", match.captured(4).toDouble() },
+            { "total", match.captured(5).toDouble() },
+            { "iterations", match.captured(6).toInt() },
+        });
+    }
+
+    QJsonObject report {
+        { "benchmark", benchmarkName },
+        { "results", results },
+    };
+    QFile jsonFile(jsonFileName);
+    if (!jsonFile.open(QIODevice::WriteOnly)) {
+        qCritical() << "Cannot write" << jsonFile.fileName();
+        return false;
+    }
+    jsonFile.write(QJsonDocument(report).toJson());
+    return true;
+}
+
+inline int exec(QObject *testObject, const QString &benchmarkName,
+                QStringList args)
+{
+    int jsonIndex = args.indexOf("--json");
+    if (jsonIndex < 0) {
+        return QTest::qExec(testObject, args);
+    }
+
+    if (jsonIndex + 1 >= args.count()) {
+        qCritical() << "Missing file name for --json";
+        return EXIT_FAILURE;
+    }
+    QString jsonFileName = args.takeAt(jsonIndex + 1);
+    args.removeAt(jsonIndex);
+
+    QTemporaryFile csvFile;
+    if (!csvFile.open()) return EXIT_FAILURE;
+    args << "-o" << csvFile.fileName() + ",csv" << "-o" << "-,txt";
+
+    int ret = QTest::qExec(testObject, args);
+    if (!writeResults(benchmarkName, csvFile.fileName(), jsonFileName)) {
+        return EXIT_FAILURE;
+    }
+    return ret;
+}
+
+} // namespace
+
+#define QTEST_JSON_MAIN(TestObject, name) \
+int main(int argc, char **argv) \
+{ \
+    QCoreApplication app(argc, argv); \
+    TestObject tc; \
+    return QTestJson::exec(&tc, name, app.arguments()); \
+}
+
+#endif // OAD_QTEST_JSON_MAIN_H